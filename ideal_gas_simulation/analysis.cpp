@@ -0,0 +1,158 @@
+#include "analysis.h"
+#include "mappedfile.h"
+#include "statistics.h"
+#include "threadpool.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <charconv>
+#include <algorithm>
+#include <math.h>
+
+namespace fs = std::filesystem;
+
+#define MSER_BATCH 5
+#define SPEED_BINS 40
+// bins expecting fewer speeds are left out of chi2
+#define CHI2_MIN_EXPECTED 5
+
+// one number per line as the listener writes them; lines that do not parse (a lone "-nan(ind)"
+// of an empty window, say) are skipped
+size_t Analysis::parse(const char* data, size_t size, std::vector<double>& values) {
+    const char* p = data, * end = data + size;
+    size_t before = values.size();
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        if (p == end) break;
+        double v;
+        std::from_chars_result r = std::from_chars(p, end, v);
+        if (r.ec == std::errc() && isfinite(v)) values.push_back(v);
+        p = r.ec == std::errc() ? r.ptr : p;
+        while (p < end && *p != '\n') p++;
+    }
+    return values.size() - before;
+}
+
+bool Analysis::read(std::string path, std::vector<double>& values) {
+    MappedFile file(path);
+    if (!file.isOpen()) return false;
+    parse(file.getData(), file.getSize(), values);
+    return true;
+}
+
+RunSummary Analysis::summarize(std::string dir, std::string file, int N, double kB, double T, double m_1, double m_2) {
+    RunSummary s;
+    s.dir = dir;
+    s.N = N;
+    s.NkBT = N * kB * T;
+    std::vector<double> pv;
+    read(dir + "/" + file, pv);
+    s.windows = (int)pv.size();
+    s.equilibration = s.windows > 0 ? Statistics::mser(pv.data(), s.windows, MSER_BATCH) : 0;
+    s.pv_mean = s.windows > 0 ? Statistics::mean(pv.data() + s.equilibration, s.windows - s.equilibration) : 0;
+    s.pv_err = s.windows > 0 ? Statistics::blockStdErr(pv.data() + s.equilibration, s.windows - s.equilibration) : 0;
+    s.ratio = s.NkBT > 0 ? s.pv_mean / s.NkBT : 0;
+    s.ratio_err = s.NkBT > 0 ? s.pv_err / s.NkBT : 0;
+
+    // every intensity file of the run, the final one and the timed samples alike
+    std::vector<double> speeds;
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind(file + "_intensities", 0) == 0) read(entry.path().string(), speeds);
+    }
+    s.speeds = (long long)speeds.size();
+    s.sigma = 0;
+    s.mix = 0;
+    s.chi2 = 0;
+    if (speeds.empty()) return s;
+    double sum2 = 0, top = 0;
+    for (double v : speeds) {
+        sum2 += v * v;
+        top = v > top ? v : top;
+    }
+    s.sigma = sqrt(sum2 / (2 * speeds.size()));
+    // <v^2> = 2 (mix sigma_1^2 + (1 - mix) sigma_2^2); with equal masses the mix is not fitted
+    double sigma2_1 = kB * T / m_1, sigma2_2 = kB * T / m_2;
+    bool mixed = fabs(sigma2_1 - sigma2_2) > 1e-12 * sigma2_1;
+    s.mix = mixed ? (s.sigma * s.sigma - sigma2_2) / (sigma2_1 - sigma2_2) : 1;
+    s.mix = s.mix < 0 ? 0 : s.mix > 1 ? 1 : s.mix;
+    if (top <= 0) return s;
+    std::vector<long long> histogram(SPEED_BINS, 0);
+    for (double v : speeds) {
+        int b = (int)(v / top * SPEED_BINS);
+        histogram[b < SPEED_BINS ? b : SPEED_BINS - 1]++;
+    }
+    double chi2 = 0;
+    int used = 0;
+    for (int b = 0; b < SPEED_BINS; b++) {
+        double a = top * b / SPEED_BINS, c = top * (b + 1) / SPEED_BINS;
+        double expected = speeds.size() * (s.mix * (exp(-a * a / (2 * sigma2_1)) - exp(-c * c / (2 * sigma2_1)))
+            + (1 - s.mix) * (exp(-a * a / (2 * sigma2_2)) - exp(-c * c / (2 * sigma2_2))));
+        if (expected < CHI2_MIN_EXPECTED) continue;
+        chi2 += (histogram[b] - expected) * (histogram[b] - expected) / expected;
+        used++;
+    }
+    // the normalisation and, for two masses, the mix are fitted
+    int fitted = mixed ? 2 : 1;
+    s.chi2 = used > fitted ? chi2 / (used - fitted) : 0;
+    return s;
+}
+
+// runs in directory order, then by N
+std::vector<RunSummary> Analysis::analyze(std::vector<std::string>& dirs, double kB, double T, double m_1, double m_2, int threads) {
+    struct Job {
+        std::string dir, file;
+        int N;
+    };
+    std::vector<Job> jobs;
+    for (std::string& dir : dirs) {
+        std::vector<Job> found;
+        std::error_code ec;
+        for (auto& entry : fs::directory_iterator(dir, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() < 5 || name.substr(name.size() - 4) != ".txt" || name.find_first_not_of("0123456789") != name.size() - 4) continue;
+            found.push_back({ dir, name, atoi(name.c_str()) });
+        }
+        if (ec) std::cerr << "Cannot read directory " << dir << std::endl;
+        std::sort(found.begin(), found.end(), [](const Job& a, const Job& b) { return a.N < b.N; });
+        jobs.insert(jobs.end(), found.begin(), found.end());
+    }
+
+    std::vector<RunSummary> runs(jobs.size());
+    ThreadPool pool(threads);
+    for (size_t l = 0; l < jobs.size(); l++)
+        pool.submit([&runs, &jobs, l, kB, T, m_1, m_2]() { runs[l] = summarize(jobs[l].dir, jobs[l].file, jobs[l].N, kB, T, m_1, m_2); });
+    pool.wait();
+    return runs;
+}
+
+// one row per run and after every directory an "all" row with the inverse variance weighted
+// pV / NkBT of its runs
+int Analysis::write(std::vector<RunSummary>& runs, std::string table) {
+    std::ofstream out(table);
+    if (!out.is_open()) {
+        std::cerr << "Cannot write analysis table " << table << std::endl;
+        return -1;
+    }
+    out << std::setprecision(10);
+    out << "dir\tN\twindows\tequilibration\tpV_mean\tpV_err\tNkBT\tratio\tratio_err\tspeeds\tsigma\tmix\tchi2" << std::endl;
+    for (size_t l = 0; l < runs.size(); l++) {
+        RunSummary& s = runs[l];
+        out << s.dir << "\t" << s.N << "\t" << s.windows << "\t" << s.equilibration << "\t" << s.pv_mean << "\t" << s.pv_err << "\t"
+            << s.NkBT << "\t" << s.ratio << "\t" << s.ratio_err << "\t" << s.speeds << "\t" << s.sigma << "\t" << s.mix << "\t" << s.chi2 << std::endl;
+        if (l + 1 < runs.size() && runs[l + 1].dir == s.dir) continue;
+        double weights = 0, sum = 0;
+        int count = 0;
+        for (size_t k = 0; k <= l; k++) {
+            if (runs[k].dir != s.dir || runs[k].ratio_err <= 0) continue;
+            double w = 1 / (runs[k].ratio_err * runs[k].ratio_err);
+            weights += w;
+            sum += w * runs[k].ratio;
+            count++;
+        }
+        if (count > 0) out << s.dir << "\tall\t" << count << "\t\t\t\t\t" << sum / weights << "\t" << 1 / sqrt(weights) << "\t\t\t\t" << std::endl;
+    }
+    return (int)runs.size();
+}
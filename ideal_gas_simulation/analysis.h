@@ -0,0 +1,31 @@
+#include <string>
+#include <vector>
+#ifndef H_ANALYSIS
+#define H_ANALYSIS
+
+// one <N>.txt pV series of a listener output directory, with the speeds of its intensity files
+struct RunSummary {
+	std::string dir;
+	int N, windows, equilibration;
+	double pv_mean, pv_err, NkBT, ratio, ratio_err;
+	long long speeds;
+	double sigma, mix, chi2;
+};
+
+// reads the text outputs of ICustomOnSimulationListener back: every file is memory mapped and
+// parsed with from_chars, one run per task on the pool. the speeds are 2d magnitudes of both
+// species, unlabelled, so they are tested against two rayleigh distributions with the expected
+// sigma_i^2 = kB T / m_i, mixed by the fraction of species 1 that matches <v^2>. sigma is the
+// measured sqrt(<v^2> / 2), chi2 is per degree of freedom
+class Analysis {
+protected:
+	static RunSummary summarize(std::string dir, std::string file, int N, double kB, double T, double m_1, double m_2);
+
+public:
+	static size_t parse(const char* data, size_t size, std::vector<double>& values);
+	static bool read(std::string path, std::vector<double>& values);
+	static std::vector<RunSummary> analyze(std::vector<std::string>& dirs, double kB, double T, double m_1, double m_2, int threads);
+	static int write(std::vector<RunSummary>& runs, std::string table);
+};
+
+#endif
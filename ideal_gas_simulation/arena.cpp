@@ -0,0 +1,58 @@
+#include "arena.h"
+#include <new>
+
+Arena::Arena(size_t capacity) {
+    block = nullptr;
+    this->capacity = 0;
+    used = 0;
+    spilled = 0;
+    reserved = 0;
+    reserve(capacity);
+}
+
+// align is at most that of operator new, which is all the engine needs
+void* Arena::allocate(size_t bytes, size_t align) {
+    if (bytes == 0) return nullptr;
+    size_t offset = (used + align - 1) / align * align;
+    if (block != nullptr && offset + bytes <= capacity) {
+        used = offset + bytes;
+        return block + offset;
+    }
+    void* p = ::operator new(bytes);
+    spills.push_back(p);
+    spilled += bytes + align;
+    return p;
+}
+
+// takes effect at once on an empty arena, otherwise at the next reset()
+void Arena::reserve(size_t bytes) {
+    if (bytes > reserved) reserved = bytes;
+    if (used == 0 && spills.empty() && reserved > capacity) {
+        ::operator delete(block);
+        block = static_cast<char*>(::operator new(reserved));
+        capacity = reserved;
+    }
+}
+
+// O(1) unless the last run spilled, in which case the block is regrown once
+void Arena::reset() {
+    size_t peak = used + spilled;
+    for (void* p : spills) ::operator delete(p);
+    spills.clear();
+    used = 0;
+    spilled = 0;
+    reserve(peak);
+}
+
+size_t Arena::getCapacity() {
+    return capacity;
+}
+
+size_t Arena::getUsed() {
+    return used + spilled;
+}
+
+Arena::~Arena() {
+    for (void* p : spills) ::operator delete(p);
+    ::operator delete(block);
+}
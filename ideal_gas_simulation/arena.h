@@ -0,0 +1,27 @@
+#include <cstddef>
+#include <vector>
+#ifndef H_ARENA
+#define H_ARENA
+
+// one block the engine carves its per-run storage from: the particles, the event pool and the
+// per-object event tables. reset() hands everything back at once. what did not fit went to extra
+// blocks, and the next reset() grows the main block to cover them, so a sweep of similar runs
+// settles on a single allocation. objects placed here are not destroyed by the arena
+class Arena {
+protected:
+	char* block;
+	size_t capacity, used, spilled, reserved;
+	std::vector<void*> spills;
+
+public:
+	Arena(size_t capacity = 0);
+	void* allocate(size_t bytes, size_t align);
+	template <class T> T* allocate(size_t n) { return static_cast<T*>(allocate(sizeof(T) * n, alignof(T))); }
+	void reserve(size_t bytes);
+	void reset();
+	size_t getCapacity();
+	size_t getUsed();
+	~Arena();
+};
+
+#endif
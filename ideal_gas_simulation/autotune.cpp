@@ -0,0 +1,125 @@
+#include "autotune.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <filesystem>
+#include <math.h>
+
+namespace fs = std::filesystem;
+
+AutoTuner::AutoTuner(std::string path) {
+    this->path = path;
+    load();
+}
+
+// one "class queue threads reorder_per_particle" per line
+void AutoTuner::load() {
+    std::ifstream in(path);
+    std::string line, tuning_class;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        int queue;
+        EngineSettings settings;
+        if (ss >> tuning_class >> queue >> settings.threads >> settings.reorder_per_particle) {
+            settings.queue = queue == MULTISET_QUEUE ? MULTISET_QUEUE : HEAP_QUEUE;
+            choices[tuning_class] = settings;
+        }
+    }
+}
+
+// other workers may share the file, so their choices are merged in and the file is replaced
+// through a private temporary
+void AutoTuner::save() {
+    std::map<std::string, EngineSettings> mine = choices;
+    load();
+    for (auto& choice : mine) choices[choice.first] = choice.second;
+    std::random_device rd;
+    std::string tmp = path + ".tmp." + std::to_string(rd());
+    std::ofstream out(tmp);
+    for (auto& choice : choices)
+        out << choice.first << " " << choice.second.queue << " " << choice.second.threads << " " << choice.second.reorder_per_particle << std::endl;
+    out.close();
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) fs::remove(tmp, ec);
+}
+
+EngineSettings AutoTuner::defaults() {
+    EngineSettings settings;
+    settings.queue = HEAP_QUEUE;
+    settings.threads = 0;
+    settings.reorder_per_particle = 0;
+    return settings;
+}
+
+void AutoTuner::apply(Simulation* sim, EngineSettings& settings) {
+    sim->setEventQueue(settings.queue);
+    sim->setThreadCount(settings.threads);
+    sim->setReorderInterval(settings.reorder_per_particle * sim->getParticleCount());
+}
+
+// projected wall time of a production run: the measured startup plus the production events
+// at the rate of the burst
+double AutoTuner::measure(std::function<Simulation*()> make, EngineSettings& settings, long long burst, long long production) {
+    Simulation* sim = make();
+    apply(sim, settings);
+    double projected = INFINITY;
+    if (sim->initialize()) {
+        auto clock_start = std::chrono::steady_clock::now();
+        long long n = sim->step(burst);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+        if (n > 0) projected = sim->getStats().startup + elapsed / n * production;
+    }
+    delete sim;
+    return projected;
+}
+
+bool AutoTuner::contains(std::string tuning_class) {
+    return choices.count(tuning_class) > 0;
+}
+
+// coordinate search over queue, thread count and reorder interval, one knob at a time; make
+// has to return a fresh, unstarted simulation of the class on every call
+EngineSettings AutoTuner::get(std::string tuning_class, std::function<Simulation*()> make, long long production) {
+    if (contains(tuning_class)) return choices[tuning_class];
+    long long burst = production / 64;
+    if (burst < AUTOTUNE_MIN_BURST) burst = production < AUTOTUNE_MIN_BURST ? production : AUTOTUNE_MIN_BURST;
+    if (burst > AUTOTUNE_MAX_BURST) burst = AUTOTUNE_MAX_BURST;
+    EngineSettings best = defaults(), candidate;
+    double best_time = measure(make, best, burst, production);
+
+    candidate = best;
+    candidate.queue = MULTISET_QUEUE;
+    double time = measure(make, candidate, burst, production);
+    if (time < best_time) {
+        best = candidate;
+        best_time = time;
+    }
+
+    if (std::thread::hardware_concurrency() > 1) {
+        candidate = best;
+        candidate.threads = 1;
+        time = measure(make, candidate, burst, production);
+        if (time < best_time) {
+            best = candidate;
+            best_time = time;
+        }
+    }
+
+    long long reorders[] = { 16, 256 };
+    for (long long reorder : reorders) {
+        candidate = best;
+        candidate.reorder_per_particle = reorder;
+        time = measure(make, candidate, burst, production);
+        if (time < best_time) {
+            best = candidate;
+            best_time = time;
+        }
+    }
+
+    choices[tuning_class] = best;
+    save();
+    return best;
+}
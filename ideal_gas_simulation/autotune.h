@@ -0,0 +1,35 @@
+#include <string>
+#include <map>
+#include <functional>
+#include "geometry.h"
+#ifndef H_AUTOTUNE
+#define H_AUTOTUNE
+
+#define AUTOTUNE_MIN_BURST 1024
+#define AUTOTUNE_MAX_BURST 65536
+
+// engine knobs that do not change the results; the reorder interval is counted in events per
+// particle, so one choice fits every N of a tuning class
+struct EngineSettings {
+	QUEUE_TYPE queue;
+	int threads;
+	long long reorder_per_particle;
+};
+
+class AutoTuner {
+protected:
+	std::string path;
+	std::map<std::string, EngineSettings> choices;
+	void load();
+	void save();
+	static double measure(std::function<Simulation*()> make, EngineSettings& settings, long long burst, long long production);
+
+public:
+	AutoTuner(std::string path);
+	bool contains(std::string tuning_class);
+	EngineSettings get(std::string tuning_class, std::function<Simulation*()> make, long long production);
+	static EngineSettings defaults();
+	static void apply(Simulation* sim, EngineSettings& settings);
+};
+
+#endif
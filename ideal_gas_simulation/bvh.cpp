@@ -0,0 +1,79 @@
+#include "bvh.h"
+#include <algorithm>
+#include <math.h>
+
+BVH::BVH(const double* lo, const double* hi, int n) {
+    std::vector<double> ctr(3 * n);
+    for (int l = 0; l < n; l++) {
+        prims.push_back(l);
+        for (int k = 0; k < 3; k++) ctr[3 * l + k] = (lo[3 * l + k] + hi[3 * l + k]) / 2;
+    }
+    if (n > 0) {
+        nodes.reserve(2 * (n / BVH_LEAF_SIZE + 1));
+        build(lo, hi, ctr, 0, n);
+    }
+}
+
+int BVH::build(const double* lo, const double* hi, std::vector<double>& ctr, int first, int count) {
+    int idx = (int)nodes.size();
+    nodes.push_back(Node());
+    Node n;
+    double clo[3], chi[3];
+    for (int k = 0; k < 3; k++) {
+        n.lo[k] = clo[k] = INFINITY;
+        n.hi[k] = chi[k] = -INFINITY;
+    }
+    for (int l = first; l < first + count; l++)
+        for (int k = 0; k < 3; k++) {
+            int p = prims[l];
+            n.lo[k] = std::min(n.lo[k], lo[3 * p + k]);
+            n.hi[k] = std::max(n.hi[k], hi[3 * p + k]);
+            clo[k] = std::min(clo[k], ctr[3 * p + k]);
+            chi[k] = std::max(chi[k], ctr[3 * p + k]);
+        }
+    n.first = first;
+    n.count = count;
+    n.left = n.right = -1;
+    if (count > BVH_LEAF_SIZE) {
+        // median split along the longest axis of the centroid bounds keeps the tree balanced
+        int axis = 0;
+        for (int k = 1; k < 3; k++) if (chi[k] - clo[k] > chi[axis] - clo[axis]) axis = k;
+        int half = count / 2;
+        std::nth_element(prims.begin() + first, prims.begin() + first + half, prims.begin() + first + count,
+            [&ctr, axis](int a, int b) { return ctr[3 * a + axis] < ctr[3 * b + axis]; });
+        n.left = build(lo, hi, ctr, first, half);
+        n.right = build(lo, hi, ctr, first + half, count - half);
+    }
+    nodes[idx] = n;
+    return idx;
+}
+
+double BVH::entry(const Node& n, const double* o, const double* d, double inflate) {
+    double tmin = 0, tmax = INFINITY;
+    for (int k = 0; k < 3; k++) {
+        double lo = n.lo[k] - inflate, hi = n.hi[k] + inflate;
+        if (d[k] == 0) {
+            if (o[k] < lo || o[k] > hi) return -1;
+            continue;
+        }
+        double t1 = (lo - o[k]) / d[k], t2 = (hi - o[k]) / d[k];
+        if (t1 > t2) std::swap(t1, t2);
+        if (t1 > tmin) tmin = t1;
+        if (t2 < tmax) tmax = t2;
+        if (tmin > tmax) return -1;
+    }
+    return tmin;
+}
+
+double BVH::distance(const Node& n, const double* p) {
+    double s = 0;
+    for (int k = 0; k < 3; k++) {
+        double e = p[k] < n.lo[k] ? n.lo[k] - p[k] : p[k] > n.hi[k] ? p[k] - n.hi[k] : 0;
+        s += e * e;
+    }
+    return sqrt(s);
+}
+
+int BVH::getNodeCount() {
+    return (int)nodes.size();
+}
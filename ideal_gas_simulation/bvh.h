@@ -0,0 +1,104 @@
+#include <vector>
+#ifndef H_BVH
+#define H_BVH
+
+#define BVH_LEAF_SIZE 4
+#define BVH_STACK 64
+
+class BVH {
+protected:
+	struct Node {
+		double lo[3], hi[3];
+		int left, right, first, count;
+	};
+	std::vector<Node> nodes;
+	std::vector<int> prims;
+	int build(const double* lo, const double* hi, std::vector<double>& ctr, int first, int count);
+	static double entry(const Node& n, const double* o, const double* d, double inflate);
+	static double distance(const Node& n, const double* p);
+
+public:
+	BVH(const double* lo, const double* hi, int n);
+	int getNodeCount();
+
+	// earliest non-negative hit(prim) along o + d t; boxes are inflated by the particle radius
+	template <class F> double firstHit(const double* o, const double* d, double inflate, F hit) {
+		double best = -1;
+		int stack[BVH_STACK], top = 0;
+		if (nodes.empty() || entry(nodes[0], o, d, inflate) < 0) return best;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& n = nodes[stack[--top]];
+			double e = entry(n, o, d, inflate);
+			if (e < 0 || (best >= 0 && e > best)) continue;
+			if (n.left < 0) {
+				for (int l = n.first; l < n.first + n.count; l++) {
+					double t = hit(prims[l]);
+					if (t >= 0 && (best < 0 || t < best)) best = t;
+				}
+				continue;
+			}
+			double el = entry(nodes[n.left], o, d, inflate), er = entry(nodes[n.right], o, d, inflate);
+			// the nearer child goes on top of the stack
+			if (el >= 0 && er >= 0 && el < er) {
+				stack[top++] = n.right;
+				stack[top++] = n.left;
+			}
+			else {
+				if (el >= 0) stack[top++] = n.left;
+				if (er >= 0) stack[top++] = n.right;
+			}
+		}
+		return best;
+	}
+
+	// primitive minimising dist(prim), which must not be smaller than the distance to its box
+	template <class F> int nearest(const double* p, F dist) {
+		int best = -1, stack[BVH_STACK], top = 0;
+		double best_d = 0;
+		if (nodes.empty()) return best;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& n = nodes[stack[--top]];
+			if (best >= 0 && distance(n, p) > best_d) continue;
+			if (n.left < 0) {
+				for (int l = n.first; l < n.first + n.count; l++) {
+					double d = dist(prims[l]);
+					if (best < 0 || d < best_d) {
+						best = prims[l];
+						best_d = d;
+					}
+				}
+				continue;
+			}
+			if (distance(nodes[n.left], p) < distance(nodes[n.right], p)) {
+				stack[top++] = n.right;
+				stack[top++] = n.left;
+			}
+			else {
+				stack[top++] = n.left;
+				stack[top++] = n.right;
+			}
+		}
+		return best;
+	}
+
+	// calls f(prim) for every primitive whose box overlaps [lo, hi]
+	template <class F> void overlap(const double* lo, const double* hi, F f) {
+		int stack[BVH_STACK], top = 0;
+		if (nodes.empty()) return;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node& n = nodes[stack[--top]];
+			if (n.hi[0] < lo[0] || n.lo[0] > hi[0] || n.hi[1] < lo[1] || n.lo[1] > hi[1] || n.hi[2] < lo[2] || n.lo[2] > hi[2]) continue;
+			if (n.left < 0) {
+				for (int l = n.first; l < n.first + n.count; l++) f(prims[l]);
+				continue;
+			}
+			stack[top++] = n.left;
+			stack[top++] = n.right;
+		}
+	}
+};
+
+#endif
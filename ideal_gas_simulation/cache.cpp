@@ -0,0 +1,49 @@
+#include "cache.h"
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+ResultCache::ResultCache(std::string dir) {
+    this->dir = dir;
+}
+
+std::string ResultCache::entryPath(std::string key) {
+    return dir + "/" + key;
+}
+
+bool ResultCache::contains(std::string key) {
+    std::error_code ec;
+    return fs::exists(entryPath(key) + "/done", ec);
+}
+
+bool ResultCache::restore(std::string key, std::string prefix, std::string name) {
+    if (!contains(key)) return false;
+    std::error_code ec;
+    fs::create_directories(prefix, ec);
+    for (auto& entry : fs::directory_iterator(entryPath(key), ec)) {
+        std::string file = entry.path().filename().string();
+        if (file.rfind(name, 0) != 0) continue;
+        fs::copy_file(entry.path(), fs::path(prefix) / file, fs::copy_options::overwrite_existing, ec);
+        if (ec) return false;
+    }
+    return true;
+}
+
+void ResultCache::store(std::string key, std::string config, std::string prefix, std::string name) {
+    std::error_code ec;
+    std::string path = entryPath(key);
+    fs::create_directories(path, ec);
+    for (auto& entry : fs::directory_iterator(prefix, ec)) {
+        std::string file = entry.path().filename().string();
+        if (file.rfind(name, 0) != 0) continue;
+        fs::copy_file(entry.path(), fs::path(path) / file, fs::copy_options::overwrite_existing, ec);
+        if (ec) return;
+    }
+
+    // the marker is renamed into place last, so an interrupted store never looks complete
+    std::ofstream marker(path + "/done.tmp");
+    marker << config << std::endl;
+    marker.close();
+    fs::rename(path + "/done.tmp", path + "/done", ec);
+}
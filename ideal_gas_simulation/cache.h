@@ -0,0 +1,17 @@
+#include <string>
+#ifndef H_CACHE
+#define H_CACHE
+
+class ResultCache {
+protected:
+	std::string dir;
+	std::string entryPath(std::string key);
+
+public:
+	ResultCache(std::string dir);
+	bool contains(std::string key);
+	bool restore(std::string key, std::string prefix, std::string name);
+	void store(std::string key, std::string config, std::string prefix, std::string name);
+};
+
+#endif
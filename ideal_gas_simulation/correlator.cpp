@@ -0,0 +1,105 @@
+#include "correlator.h"
+#include <fstream>
+#include <iomanip>
+
+MultiTauCorrelator::MultiTauCorrelator(CORRELATION_TYPE type, int dim, std::vector<int>& group, int groups, double interval) : MultiTauCorrelator(type, dim, group, groups, interval, CORRELATOR_POINTS, CORRELATOR_AVERAGE, CORRELATOR_LEVELS) {
+}
+
+// group[i] is the group of item i, whose dim components follow each other in the samples
+MultiTauCorrelator::MultiTauCorrelator(CORRELATION_TYPE type, int dim, std::vector<int>& group, int groups, double interval, int p, int m, int levels) {
+    this->type = type;
+    this->n = (int)group.size();
+    this->dim = dim;
+    this->groups = groups;
+    this->p = p;
+    this->m = m;
+    this->levels = levels;
+    this->interval = interval;
+    this->group = group;
+    group_size.assign(groups, 0);
+    for (int g : group) group_size[g]++;
+    // reserved, so the levels do not move while a coarser one is being added
+    shift.reserve(levels);
+    accumulator.reserve(levels);
+    sums.reserve(levels);
+    counts.reserve(levels);
+}
+
+// levels are allocated when the first average reaches them
+void MultiTauCorrelator::add(const double* values, int level) {
+    if (level >= levels) return;
+    size_t width = (size_t)n * dim;
+    if (level == (int)shift.size()) {
+        shift.push_back(std::vector<double>(p * width));
+        accumulator.push_back(std::vector<double>(width, 0));
+        sums.push_back(std::vector<double>((size_t)p * groups, 0));
+        counts.push_back(std::vector<long long>(p, 0));
+        head.push_back(0);
+        filled.push_back(0);
+        accumulated.push_back(0);
+    }
+
+    head[level] = (head[level] + p - 1) % p;
+    double* newest = &shift[level][head[level] * width];
+    std::copy(values, values + width, newest);
+    if (filled[level] < p) filled[level]++;
+
+    // lags below p / m are already covered more finely by the level underneath
+    for (int j = level == 0 ? 0 : p / m; j < filled[level]; j++) {
+        const double* older = &shift[level][((head[level] + j) % p) * width];
+        double* sum = &sums[level][(size_t)j * groups];
+        for (int i = 0; i < n; i++) {
+            double f = 0;
+            for (int k = i * dim; k < (i + 1) * dim; k++)
+                f += type == PRODUCT_CORRELATION ? newest[k] * older[k] : (newest[k] - older[k]) * (newest[k] - older[k]);
+            sum[group[i]] += f;
+        }
+        counts[level][j]++;
+    }
+
+    std::vector<double>& acc = accumulator[level];
+    for (size_t k = 0; k < width; k++) acc[k] += values[k];
+    if (++accumulated[level] == m) {
+        for (size_t k = 0; k < width; k++) acc[k] /= m;
+        add(acc.data(), level + 1);
+        std::fill(acc.begin(), acc.end(), 0);
+        accumulated[level] = 0;
+    }
+}
+
+void MultiTauCorrelator::add(const double* values) {
+    add(values, 0);
+}
+
+int MultiTauCorrelator::getGroupCount() {
+    return groups;
+}
+
+// lags in ascending order, in the units of interval
+int MultiTauCorrelator::getResult(int g, std::vector<double>& lags, std::vector<double>& values) {
+    lags.clear();
+    values.clear();
+    double scale = 1;
+    for (int level = 0; level < (int)sums.size(); level++, scale *= m)
+        for (int j = level == 0 ? 0 : p / m; j < p; j++) {
+            if (counts[level][j] == 0) continue;
+            lags.push_back(j * scale * interval);
+            values.push_back(group_size[g] > 0 ? sums[level][(size_t)j * groups + g] / (counts[level][j] * group_size[g]) : 0);
+        }
+    return (int)lags.size();
+}
+
+// one line per lag: the lag, then the value of every group
+bool MultiTauCorrelator::write(std::string path) {
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+    out << std::setprecision(17);
+    std::vector<std::vector<double>> lags(groups), values(groups);
+    for (int g = 0; g < groups; g++) getResult(g, lags[g], values[g]);
+    for (size_t l = 0; l < lags[0].size(); l++) {
+        out << lags[0][l];
+        for (int g = 0; g < groups; g++) out << "\t" << values[g][l];
+        out << std::endl;
+    }
+    return true;
+}
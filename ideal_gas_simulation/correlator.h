@@ -0,0 +1,37 @@
+#include <string>
+#include <vector>
+#ifndef H_CORRELATOR
+#define H_CORRELATOR
+
+#define CORRELATOR_POINTS 16
+#define CORRELATOR_AVERAGE 2
+#define CORRELATOR_LEVELS 32
+
+enum CORRELATION_TYPE {PRODUCT_CORRELATION, DISPLACEMENT_CORRELATION};
+
+// multiple-tau correlator: level k keeps the last p samples averaged over m^k sampling
+// intervals, so lags up to p m^k cost O(n p k) memory and O(n p) work per sample on average.
+// PRODUCT_CORRELATION gives <a(t) . a(t + lag)>, DISPLACEMENT_CORRELATION <|a(t + lag) - a(t)|^2>;
+// both are averaged over the items of a group
+class MultiTauCorrelator {
+protected:
+	CORRELATION_TYPE type;
+	int n, dim, groups, p, m, levels;
+	double interval;
+	std::vector<int> group;
+	std::vector<double> group_size;
+	std::vector<std::vector<double>> shift, accumulator, sums;
+	std::vector<std::vector<long long>> counts;
+	std::vector<int> head, filled, accumulated;
+	void add(const double* values, int level);
+
+public:
+	MultiTauCorrelator(CORRELATION_TYPE type, int dim, std::vector<int>& group, int groups, double interval);
+	MultiTauCorrelator(CORRELATION_TYPE type, int dim, std::vector<int>& group, int groups, double interval, int p, int m, int levels);
+	void add(const double* values);
+	int getGroupCount();
+	int getResult(int g, std::vector<double>& lags, std::vector<double>& values);
+	bool write(std::string path);
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "dsmc.h"
+#include "statistics.h"
+#include <math.h>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+#define MSER_BATCH 5
+#define MIN_PRODUCTION_STEPS 32
+#define PI 3.14159265358979323846
+#define DSMC_PARTICLE_CHUNK 4096
+#define DSMC_CELL_CHUNK 256
+// cells are kept at half a mean free path, but never below this many particles on average
+#define DSMC_MIN_PER_CELL 8
+
+SimulationDSMC::SimulationDSMC(int dim, double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N, double weight) {
+    this->dim = dim == 3 ? 3 : 2;
+    this->kB = kB;
+    this->T = T;
+    this->hfw = hfw;
+    this->pc1 = new ParticleConfig(pc1);
+    this->pc2 = new ParticleConfig(pc2);
+    this->rate = rate;
+    this->sim_step = sim_step;
+    this->sim_count = sim_count;
+    this->n = N > 0 ? N : 0;
+    this->weight = weight > 0 ? weight : 1;
+    this->seed = std::chrono::steady_clock::now().time_since_epoch().count();
+    Vs = this->dim == 3 ? hfw / 3 : hfw / 2;
+    tolerance = 0;
+    dt = 0;
+    cells_axis = 0;
+    cells = 0;
+    cell_size = 0;
+    sim_time = 0;
+    steps = 0;
+    collisions = 0;
+    equilibration_step = 0;
+    pv_mean = 0;
+    pv_err = 0;
+    window_dp = 0;
+    window_dt = 0;
+    estimate_stale = false;
+    threads = 0;
+    pool = nullptr;
+    listener = nullptr;
+}
+
+void SimulationDSMC::setOnSimulationListener(IOnSimulationListener* listener) {
+    this->listener = listener;
+}
+
+void SimulationDSMC::setSeed(unsigned long long seed) {
+    this->seed = seed;
+}
+
+void SimulationDSMC::setAdaptive(double tolerance) {
+    this->tolerance = tolerance;
+}
+
+// 0 = one per hardware thread
+void SimulationDSMC::setThreadCount(int threads) {
+    this->threads = threads;
+}
+
+// 0 = a fifth of the time the mean particle takes to cross a cell or a mean free path
+void SimulationDSMC::setTimeStep(double dt) {
+    this->dt = dt;
+}
+
+// 0 = chosen from the mean free path and the particle count
+void SimulationDSMC::setCells(int per_axis) {
+    cells_axis = per_axis;
+}
+
+double SimulationDSMC::radius(int l) {
+    return first[l] ? pc1->getRadius() : pc2->getRadius();
+}
+
+double SimulationDSMC::mass(int l) {
+    return first[l] ? pc1->getMass() : pc2->getMass();
+}
+
+// hard spheres: the area pi d^2 in 3d, the length 2 d for disks
+double SimulationDSMC::crossSection(double ra, double rb) {
+    double d = ra + rb;
+    return dim == 3 ? PI * d * d : 2 * d;
+}
+
+// of the mixture, in real particles
+double SimulationDSMC::meanFreePath() {
+    double p1 = rate < 0 ? 0 : (rate > 1 ? 1 : rate), r1 = pc1->getRadius(), r2 = pc2->getRadius();
+    double sigma = p1 * p1 * crossSection(r1, r1) + 2 * p1 * (1 - p1) * crossSection(r1, r2) + (1 - p1) * (1 - p1) * crossSection(r2, r2);
+    double density = n * weight / pow(2 * hfw, dim);
+    return 1 / (sqrt(2.0) * density * sigma);
+}
+
+bool SimulationDSMC::initialize() {
+    if (pool != nullptr) return true;
+    if (n < 2) return false;
+    random.setSeed(seed);
+    first.resize(n);
+    c.resize((size_t)n * dim);
+    v.resize((size_t)n * dim);
+    std::vector<double> sigma(n);
+    double sigma_1 = sqrt(kB * T / pc1->getMass()), sigma_2 = sqrt(kB * T / pc2->getMass());
+    for (int l = 0; l < n; l++) {
+        first[l] = random.uniform(STREAM_SPECIES, l) <= rate;
+        sigma[l] = first[l] ? sigma_1 : sigma_2;
+        double lo = -hfw + radius(l), u[4];
+        random.uniform2(STREAM_POSITION, l, 0, u[0], u[1]);
+        random.uniform2(STREAM_POSITION, l, 1, u[2], u[3]);
+        for (int k = 0; k < dim; k++) c[(size_t)l * dim + k] = lo + 2 * (-lo) * u[k];
+    }
+    random.maxwell(STREAM_VELOCITY, 0, n, dim, sigma.data(), v.data());
+
+    double m_min = pc1->getMass() < pc2->getMass() ? pc1->getMass() : pc2->getMass();
+    double mean_speed = sqrt(8 * kB * T / (PI * m_min)), path = meanFreePath();
+    if (cells_axis <= 0) {
+        double by_count = floor(pow((double)n / DSMC_MIN_PER_CELL, 1.0 / dim)), by_path = ceil(4 * hfw / path);
+        cells_axis = (int)(by_path < by_count ? by_path : by_count);
+        if (cells_axis < 1) cells_axis = 1;
+    }
+    cell_size = 2 * hfw / cells_axis;
+    cells = dim == 3 ? cells_axis * cells_axis * cells_axis : cells_axis * cells_axis;
+    if (dt <= 0) dt = 0.2 * (cell_size < path ? cell_size : path) / mean_speed;
+
+    // the largest species present; (sigma g)_max only grows from there
+    double r_max = 0;
+    for (int l = 0; l < n; l++) r_max = radius(l) > r_max ? radius(l) : r_max;
+    sg_max.assign(cells, crossSection(r_max, r_max) * 2 * mean_speed);
+    remainder.assign(cells, 0);
+    cell_start.assign(cells + 1, 0);
+    cell_items.resize(n);
+    particle_cell.resize(n);
+    chunk_dp.assign((n + DSMC_PARTICLE_CHUNK - 1) / DSMC_PARTICLE_CHUNK, 0);
+    chunk_collisions.assign((cells + DSMC_CELL_CHUNK - 1) / DSMC_CELL_CHUNK, 0);
+    sim_time = 0;
+    steps = 0;
+    collisions = 0;
+    window_dp = 0;
+    window_dt = 0;
+    pool = new ThreadPool(threads);
+    if (listener != nullptr) listener->OnSimulationStart(nullptr, 0);
+    return true;
+}
+
+// free flight for dt with specular walls; also finds every particle's cell
+void SimulationDSMC::moveChunk(int chunk) {
+    int from = chunk * DSMC_PARTICLE_CHUNK, to = from + DSMC_PARTICLE_CHUNK < n ? from + DSMC_PARTICLE_CHUNK : n;
+    double dp = 0;
+    for (int l = from; l < to; l++) {
+        double lo = -hfw + radius(l), hi = hfw - radius(l), m = mass(l);
+        int cell = 0;
+        for (int k = 0; k < dim; k++) {
+            double& x = c[(size_t)l * dim + k], & u = v[(size_t)l * dim + k];
+            x += u * dt;
+            while (x < lo || x > hi) {
+                x = x < lo ? 2 * lo - x : 2 * hi - x;
+                u = -u;
+                dp += 2 * m * fabs(u);
+            }
+            int i = (int)((x + hfw) / cell_size);
+            cell = cell * cells_axis + (i < 0 ? 0 : (i >= cells_axis ? cells_axis - 1 : i));
+        }
+        particle_cell[l] = cell;
+    }
+    chunk_dp[chunk] = dp;
+}
+
+// counting sort by cell, serial and in particle order so the cell contents are reproducible
+void SimulationDSMC::sortCells() {
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+    for (int l = 0; l < n; l++) cell_start[particle_cell[l] + 1]++;
+    for (int l = 0; l < cells; l++) cell_start[l + 1] += cell_start[l];
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int l = 0; l < n; l++) cell_items[fill[particle_cell[l]]++] = l;
+}
+
+// u: two uniforms for the scattering. in 3d hard spheres scatter isotropically in the centre
+// of mass frame; disks are reflected off the contact normal of a uniform impact parameter
+void SimulationDSMC::collide(int a, int b, const double* u) {
+    double ma = mass(a), mb = mass(b), M = ma + mb;
+    double* va = &v[(size_t)a * dim], * vb = &v[(size_t)b * dim];
+    double g[3], cm[3], gp[3];
+    for (int k = 0; k < dim; k++) {
+        g[k] = va[k] - vb[k];
+        cm[k] = (ma * va[k] + mb * vb[k]) / M;
+    }
+    if (dim == 3) {
+        double gm = sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+        double cos_chi = 2 * u[0] - 1, sin_chi = sqrt(1 - cos_chi * cos_chi), phi = 2 * PI * u[1];
+        gp[0] = gm * cos_chi;
+        gp[1] = gm * sin_chi * cos(phi);
+        gp[2] = gm * sin_chi * sin(phi);
+    }
+    else {
+        double gm = sqrt(g[0] * g[0] + g[1] * g[1]);
+        double s = 2 * u[0] - 1, c_a = sqrt(1 - s * s);
+        // contact normal at angle asin(s) to g
+        double nx = (c_a * g[0] - s * g[1]) / gm, ny = (c_a * g[1] + s * g[0]) / gm, gn = g[0] * nx + g[1] * ny;
+        gp[0] = g[0] - 2 * gn * nx;
+        gp[1] = g[1] - 2 * gn * ny;
+    }
+    for (int k = 0; k < dim; k++) {
+        va[k] = cm[k] + mb / M * gp[k];
+        vb[k] = cm[k] - ma / M * gp[k];
+    }
+}
+
+// no-time-counter: 1/2 n (n - 1) F_N (sigma g)_max dt / V_c candidate pairs, each accepted with
+// sigma g / (sigma g)_max; the fraction of a pair is carried to the next step
+void SimulationDSMC::collideChunk(int chunk) {
+    int from = chunk * DSMC_CELL_CHUNK, to = from + DSMC_CELL_CHUNK < cells ? from + DSMC_CELL_CHUNK : cells;
+    double volume = pow(cell_size, dim);
+    long long count = 0;
+    for (int cell = from; cell < to; cell++) {
+        int first_item = cell_start[cell], items = cell_start[cell + 1] - first_item;
+        if (items < 2) continue;
+        double select = 0.5 * items * (items - 1) * weight * sg_max[cell] * dt / volume + remainder[cell];
+        long long candidates = (long long)select;
+        remainder[cell] = select - candidates;
+        uint64_t id = (uint64_t)steps * cells + cell;
+        uint32_t draw = 0;
+        for (long long l = 0; l < candidates; l++) {
+            double u[6];
+            random.uniform2(STREAM_COLLISION, id, draw++, u[0], u[1]);
+            random.uniform2(STREAM_COLLISION, id, draw++, u[2], u[3]);
+            int i = (int)(u[0] * items), j = (int)(u[1] * (items - 1));
+            if (i >= items) i = items - 1;
+            if (j >= items - 1) j = items - 2;
+            if (j >= i) j++;
+            int a = cell_items[first_item + i], b = cell_items[first_item + j];
+            double g2 = 0;
+            for (int k = 0; k < dim; k++) {
+                double d = v[(size_t)a * dim + k] - v[(size_t)b * dim + k];
+                g2 += d * d;
+            }
+            double sg = crossSection(radius(a), radius(b)) * sqrt(g2);
+            if (sg > sg_max[cell]) sg_max[cell] = sg;
+            if (u[2] * sg_max[cell] > sg) continue;
+            random.uniform2(STREAM_COLLISION, id, draw++, u[4], u[5]);
+            collide(a, b, u + 3);
+            count++;
+        }
+    }
+    chunk_collisions[chunk] = count;
+}
+
+// n more steps without any listener calls
+long long SimulationDSMC::step(long long count) {
+    if (!initialize()) return 0;
+    for (long long s = 0; s < count; s++) {
+        int move_chunks = (int)chunk_dp.size(), collide_chunks = (int)chunk_collisions.size();
+        for (int k = 0; k < move_chunks; k++) pool->submit([this, k]() { moveChunk(k); });
+        pool->wait();
+        sortCells();
+        for (int k = 0; k < collide_chunks; k++) pool->submit([this, k]() { collideChunk(k); });
+        pool->wait();
+        for (int k = 0; k < move_chunks; k++) window_dp += chunk_dp[k];
+        for (int k = 0; k < collide_chunks; k++) collisions += chunk_collisions[k];
+        window_dt += dt;
+        sim_time += dt;
+        steps++;
+        if (steps % sim_step == 0) {
+            // every simulated particle carries weight real ones to the walls
+            pv_series.push_back(Vs * weight * window_dp / window_dt);
+            window_dp = 0;
+            window_dt = 0;
+            estimate_stale = true;
+        }
+    }
+    return count;
+}
+
+void SimulationDSMC::run() {
+    if (!initialize()) return;
+    int next_check = 2 * MIN_PRODUCTION_STEPS;
+    for (long long b = 0; b < sim_count * sim_step; b++) {
+        bool converged = false;
+        int before = (int)pv_series.size();
+        step(1);
+        if ((int)pv_series.size() > before) {
+            int windows = (int)pv_series.size();
+            if (listener != nullptr) listener->OnSimulationStep(pv_series.back(), n * weight * kB * T, windows - 1);
+            if (tolerance > 0 && windows >= next_check) {
+                next_check = windows + (windows / 16 > MIN_PRODUCTION_STEPS ? windows / 16 : MIN_PRODUCTION_STEPS);
+                updatePVEstimate();
+                converged = windows - equilibration_step >= MIN_PRODUCTION_STEPS && pv_err < tolerance * fabs(pv_mean);
+            }
+        }
+        if (listener != nullptr) listener->OnSimulationIteration(nullptr, 0, (int)(steps - 1));
+        if (converged) break;
+    }
+    updatePVEstimate();
+    if (listener != nullptr) listener->OnSimulationEnd(nullptr, 0);
+}
+
+void SimulationDSMC::updatePVEstimate() {
+    int windows = (int)pv_series.size();
+    estimate_stale = false;
+    equilibration_step = Statistics::mser(pv_series.data(), windows, MSER_BATCH);
+    pv_mean = Statistics::mean(pv_series.data() + equilibration_step, windows - equilibration_step);
+    pv_err = Statistics::blockStdErr(pv_series.data() + equilibration_step, windows - equilibration_step);
+}
+
+std::string SimulationDSMC::getConfigString() {
+    std::ostringstream ss;
+    ss << std::hexfloat << "dsmc;dim=" << dim << ";kB=" << kB << ";T=" << T << ";hfw=" << hfw
+        << ";pc1=" << pc1->getId() << "," << pc1->getRadius() << "," << pc1->getMass()
+        << ";pc2=" << pc2->getId() << "," << pc2->getRadius() << "," << pc2->getMass()
+        << ";rate=" << rate << ";sim_step=" << sim_step << ";sim_count=" << sim_count
+        << ";N=" << n << ";weight=" << weight << ";dt=" << dt << ";cells=" << cells_axis
+        << ";tolerance=" << tolerance << ";seed=" << seed << ";version=" << ENGINE_VERSION;
+    return ss.str();
+}
+
+double SimulationDSMC::getTime() {
+    return sim_time;
+}
+
+// both are fixed by the first step when left at 0
+double SimulationDSMC::getTimeStep() {
+    return dt;
+}
+
+int SimulationDSMC::getCellCount() {
+    return cells;
+}
+
+long long SimulationDSMC::getCollisionCount() {
+    return collisions;
+}
+
+int SimulationDSMC::getParticleCount() {
+    return n;
+}
+
+int SimulationDSMC::getStepCount() {
+    return (int)pv_series.size();
+}
+
+int SimulationDSMC::getEquilibrationStep() {
+    if (estimate_stale) updatePVEstimate();
+    return equilibration_step;
+}
+
+double SimulationDSMC::getMeanPV() {
+    if (estimate_stale) updatePVEstimate();
+    return pv_mean;
+}
+
+double SimulationDSMC::getStdErrPV() {
+    if (estimate_stale) updatePVEstimate();
+    return pv_err;
+}
+
+// of the simulated particles
+double SimulationDSMC::getKineticEnergy() {
+    double energy = 0;
+    for (int l = 0; l < (int)first.size(); l++)
+        for (int k = 0; k < dim; k++) energy += mass(l) * v[(size_t)l * dim + k] * v[(size_t)l * dim + k] / 2;
+    return energy;
+}
+
+// same layout as Simulation::snapshot; returns dim
+int SimulationDSMC::snapshot(std::vector<double>& positions, std::vector<double>& velocities) {
+    positions = c;
+    velocities = v;
+    return dim;
+}
+
+SimulationDSMC::~SimulationDSMC() {
+    delete pc1;
+    delete pc2;
+    if (pool != nullptr) delete pool;
+}
@@ -0,0 +1,72 @@
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "rng.h"
+#include "threadpool.h"
+#ifndef H_DSMC
+#define H_DSMC
+
+// direct simulation monte carlo in the box [-hfw, hfw]^dim, for states too dilute for the
+// event driven engine to be worth its N^2 pairs. every simulated particle stands for weight
+// real ones; they fly ballistically for dt, are sorted into cells and then collide by bird's
+// no-time-counter scheme, cell by cell on the pool. every cell draws from its own stream, so
+// the run is reproducible whatever the thread count. a window is sim_step steps; pV comes from
+// the momentum given to the walls, as in Simulation
+class SimulationDSMC {
+protected:
+	int dim, n, cells_axis, cells;
+	long long sim_step, sim_count, steps, collisions;
+	unsigned long long seed;
+	double kB, T, hfw, Vs, rate, weight, tolerance, dt, cell_size, sim_time;
+	ParticleConfig* pc1, * pc2;
+	std::vector<double> c, v;
+	std::vector<char> first;
+	std::vector<int> cell_start, cell_items, particle_cell;
+	std::vector<double> sg_max, remainder;
+	std::vector<double> chunk_dp;
+	std::vector<long long> chunk_collisions;
+	int equilibration_step;
+	double pv_mean, pv_err, window_dp, window_dt;
+	std::vector<double> pv_series;
+	bool estimate_stale;
+	int threads;
+	ThreadPool* pool;
+	CounterRNG random;
+	IOnSimulationListener* listener;
+	double radius(int l);
+	double mass(int l);
+	double crossSection(double ra, double rb);
+	double meanFreePath();
+	bool initialize();
+	void moveChunk(int chunk);
+	void sortCells();
+	void collideChunk(int chunk);
+	void collide(int a, int b, const double* u);
+	void updatePVEstimate();
+
+public:
+	SimulationDSMC(int dim, double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N, double weight);
+	void setOnSimulationListener(IOnSimulationListener* listener);
+	void setSeed(unsigned long long seed);
+	void setAdaptive(double tolerance);
+	void setThreadCount(int threads);
+	void setTimeStep(double dt);
+	void setCells(int per_axis);
+	std::string getConfigString();
+	void run();
+	long long step(long long n);
+	double getTime();
+	double getTimeStep();
+	int getCellCount();
+	long long getCollisionCount();
+	int getParticleCount();
+	int getStepCount();
+	int getEquilibrationStep();
+	double getMeanPV();
+	double getStdErrPV();
+	double getKineticEnergy();
+	int snapshot(std::vector<double>& positions, std::vector<double>& velocities);
+	~SimulationDSMC();
+};
+
+#endif
@@ -0,0 +1,404 @@
+#include "eventlog.h"
+#include <string.h>
+#include <new>
+
+EventLog::EventLog(std::string path) {
+    out.open(path, std::ios::binary);
+    buffer.reserve(EVENTLOG_BUFFER);
+}
+
+bool EventLog::isOpen() {
+    return out.is_open();
+}
+
+// LEB128, so the small ids of a few thousand objects take one or two bytes
+void EventLog::putVarint(unsigned long long v) {
+    while (v >= 0x80) {
+        buffer.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    buffer.push_back((char)v);
+}
+
+void EventLog::putDouble(double d) {
+    char bytes[sizeof(double)];
+    memcpy(bytes, &d, sizeof(double));
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(double));
+}
+
+void EventLog::putInt(int i) {
+    char bytes[sizeof(int)];
+    memcpy(bytes, &i, sizeof(int));
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(int));
+}
+
+void EventLog::flush() {
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    buffer.clear();
+}
+
+void EventLog::writeHeader(PhObject** objs, int objs_len, int walls_len, unsigned long long seed, std::string config) {
+    int dim = objs_len > walls_len && objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+    buffer.insert(buffer.end(), EVENTLOG_MAGIC, EVENTLOG_MAGIC + 8);
+    putInt(dim);
+    putInt(walls_len);
+    putInt(objs_len - walls_len);
+    putVarint(seed);
+    putVarint(config.size());
+    buffer.insert(buffer.end(), config.begin(), config.end());
+
+    for (int l = 0; l < walls_len; l++) {
+        putInt(objs[l]->getType());
+        if (objs[l]->getType() == LINE_2D || objs[l]->getType() == CONTAINER_2D) {
+            Container2D* container = objs[l]->getType() == CONTAINER_2D ? static_cast<Container2D*>(objs[l]) : nullptr;
+            int n = container != nullptr ? container->getSegmentCount() : 1;
+            putInt(n);
+            for (int k = 0; k < n; k++) {
+                Line2D* line = container != nullptr ? container->getSegment(k) : static_cast<Line2D*>(objs[l]);
+                putInt(line->getSide());
+                putDouble(line->getFirstPoint()->getX());
+                putDouble(line->getFirstPoint()->getY());
+                putDouble(line->getSecondPoint()->getX());
+                putDouble(line->getSecondPoint()->getY());
+            }
+        }
+        else {
+            Container3D* container = objs[l]->getType() == CONTAINER_3D ? static_cast<Container3D*>(objs[l]) : nullptr;
+            int n = container != nullptr ? container->getFacetCount() : 1;
+            putInt(n);
+            for (int k = 0; k < n; k++) {
+                Triangle* triangle = container != nullptr ? container->getFacet(k) : static_cast<Triangle*>(objs[l]);
+                Point3D* p[3] = { triangle->getFirstPoint(), triangle->getSecondPoint(), triangle->getThirdPoint() };
+                putInt(triangle->getSide());
+                for (int j = 0; j < 3; j++) {
+                    putDouble(p[j]->getX());
+                    putDouble(p[j]->getY());
+                    putDouble(p[j]->getZ());
+                }
+            }
+        }
+    }
+
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            putInt(p->getIndex());
+            putInt(p->getId());
+            putDouble(p->getRadius());
+            putDouble(p->getMass());
+            putDouble(p->getCenter()->getX());
+            putDouble(p->getCenter()->getY());
+            putDouble(p->getCenter()->getZ());
+            putDouble(p->getVelocity()->getX());
+            putDouble(p->getVelocity()->getY());
+            putDouble(p->getVelocity()->getZ());
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            putInt(p->getIndex());
+            putInt(p->getId());
+            putDouble(p->getRadius());
+            putDouble(p->getMass());
+            putDouble(p->getCenter()->getX());
+            putDouble(p->getCenter()->getY());
+            putDouble(p->getVelocity()->getX());
+            putDouble(p->getVelocity()->getY());
+        }
+    }
+    flush();
+}
+
+void EventLog::writeEvent(int a, int b, double dt) {
+    putVarint(a);
+    putVarint(b);
+    putDouble(dt);
+    if (buffer.size() >= EVENTLOG_BUFFER - 32) flush();
+}
+
+EventLog::~EventLog() {
+    flush();
+    out.close();
+}
+
+Replay::Replay(std::string path) {
+    file = new MappedFile(path);
+    offset = 0;
+    dim = 2;
+    walls_len = 0;
+    objs_len = 0;
+    seed = 0;
+    objs = nullptr;
+    particles_pool = nullptr;
+    event = 0;
+    t = 0;
+    sample_time = 0;
+    dirty = false;
+    if (!file->isOpen() || !readHeader()) {
+        delete file;
+        file = nullptr;
+        return;
+    }
+    checkpoints.push_back(Checkpoint());
+    save(checkpoints.back());
+}
+
+bool Replay::getVarint(unsigned long long& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (offset >= file->getSize()) return false;
+        unsigned char byte = (unsigned char)file->getData()[offset++];
+        v |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool Replay::getBytes(void* to, size_t n) {
+    if (offset + n > file->getSize()) return false;
+    memcpy(to, file->getData() + offset, n);
+    offset += n;
+    return true;
+}
+
+bool Replay::readHeader() {
+    char magic[8];
+    int n;
+    unsigned long long length;
+    if (!getBytes(magic, 8) || memcmp(magic, EVENTLOG_MAGIC, 8) != 0) return false;
+    if (!getBytes(&dim, sizeof(int)) || !getBytes(&walls_len, sizeof(int)) || !getBytes(&n, sizeof(int))) return false;
+    if (!getVarint(seed) || !getVarint(length) || offset + length > file->getSize()) return false;
+    config = std::string(file->getData() + offset, length);
+    offset += length;
+
+    objs_len = walls_len + n;
+    objs = new PhObject * [objs_len];
+    for (int l = 0; l < objs_len; l++) objs[l] = nullptr;
+    for (int l = 0; l < walls_len; l++) {
+        int type, count, side;
+        if (!getBytes(&type, sizeof(int)) || !getBytes(&count, sizeof(int)) || count < 1) return false;
+        if (type == LINE_2D || type == CONTAINER_2D) {
+            std::vector<Point2D> vertices;
+            std::vector<int> indices;
+            double c[4];
+            for (int k = 0; k < count; k++) {
+                if (!getBytes(&side, sizeof(int)) || !getBytes(c, sizeof(c))) return false;
+                vertices.push_back(Point2D(c[0], c[1]));
+                vertices.push_back(Point2D(c[2], c[3]));
+                indices.push_back(2 * k);
+                indices.push_back(2 * k + 1);
+            }
+            // container sides follow from the orientation of the outline, as when loaded
+            if (type == LINE_2D) objs[l] = new Line2D(&vertices[0], &vertices[1], side);
+            else objs[l] = new Container2D(vertices, indices);
+        }
+        else {
+            std::vector<Point3D> vertices;
+            std::vector<int> indices;
+            double c[9];
+            for (int k = 0; k < count; k++) {
+                if (!getBytes(&side, sizeof(int)) || !getBytes(c, sizeof(c))) return false;
+                for (int j = 0; j < 3; j++) {
+                    vertices.push_back(Point3D(c[3 * j], c[3 * j + 1], c[3 * j + 2]));
+                    indices.push_back(3 * k + j);
+                }
+            }
+            if (type == TRIANGLE) objs[l] = new Triangle(&vertices[0], &vertices[1], &vertices[2], side);
+            else objs[l] = new Container3D(vertices, indices);
+        }
+    }
+
+    size_t size = dim == 3 ? sizeof(Particle3D) : sizeof(Particle2D);
+    particles_pool = ::operator new(size * (n > 0 ? n : 1));
+    for (int l = 0; l < n; l++) {
+        int index, id;
+        double rm[2], c[6];
+        if (!getBytes(&index, sizeof(int)) || !getBytes(&id, sizeof(int)) || !getBytes(rm, sizeof(rm)) || !getBytes(c, 2 * dim * sizeof(double))) return false;
+        if (index < 0 || index >= n || objs[walls_len + index] != nullptr) return false;
+        if (dim == 3) {
+            Point3D center(c[0], c[1], c[2]);
+            Particle3D* p = new (static_cast<Particle3D*>(particles_pool) + index) Particle3D(id, &center, rm[0], rm[1], c[3], c[4], c[5]);
+            p->setIndex(index);
+            objs[walls_len + index] = p;
+        }
+        else {
+            Point2D center(c[0], c[1]);
+            Particle2D* p = new (static_cast<Particle2D*>(particles_pool) + index) Particle2D(id, &center, rm[0], rm[1], c[2], c[3]);
+            p->setIndex(index);
+            objs[walls_len + index] = p;
+        }
+    }
+    return true;
+}
+
+// positions are advanced by exactly the logged steps, so the state matches the run bit for bit
+bool Replay::next() {
+    size_t at = offset;
+    unsigned long long a, b;
+    double dt;
+    if (!getVarint(a) || !getVarint(b) || !getBytes(&dt, sizeof(double)) || a >= (unsigned long long)objs_len || b >= (unsigned long long)objs_len) {
+        offset = at;
+        return false;
+    }
+    for (int l = 0; l < objs_len; l++) objs[l]->progress(dt);
+    t += dt;
+    // a free flight record moves the particles but is not an event
+    if (a == b) return true;
+    PhObject::collision(objs[a], objs[b], dt);
+    event++;
+    if (event % REPLAY_CHECKPOINT == 0 && checkpoints.back().event < event) {
+        checkpoints.push_back(Checkpoint());
+        save(checkpoints.back());
+    }
+    return true;
+}
+
+void Replay::save(Checkpoint& cp) {
+    cp.event = event;
+    cp.offset = offset;
+    cp.t = t;
+    cp.state.resize((size_t)2 * dim * (objs_len - walls_len));
+    double* s = cp.state.data();
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            *s++ = p->getCenter()->getX();
+            *s++ = p->getCenter()->getY();
+            *s++ = p->getCenter()->getZ();
+            *s++ = p->getVelocity()->getX();
+            *s++ = p->getVelocity()->getY();
+            *s++ = p->getVelocity()->getZ();
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            *s++ = p->getCenter()->getX();
+            *s++ = p->getCenter()->getY();
+            *s++ = p->getVelocity()->getX();
+            *s++ = p->getVelocity()->getY();
+        }
+    }
+}
+
+void Replay::restore(Checkpoint& cp) {
+    event = cp.event;
+    offset = cp.offset;
+    t = cp.t;
+    const double* s = cp.state.data();
+    for (int l = walls_len; l < objs_len; l++, s += 2 * dim) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            p->getCenter()->set(s[0], s[1], s[2]);
+            p->getVelocity()->set(s[3], s[4], s[5]);
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            p->getCenter()->set(s[0], s[1]);
+            p->getVelocity()->set(s[2], s[3]);
+        }
+    }
+}
+
+bool Replay::isOpen() {
+    return file != nullptr;
+}
+
+int Replay::getDimension() {
+    return dim;
+}
+
+int Replay::getObjectsLen() {
+    return objs_len;
+}
+
+int Replay::getWallsLen() {
+    return walls_len;
+}
+
+// walls first, then the particles ordered by index
+PhObject** Replay::getObjects() {
+    return objs;
+}
+
+unsigned long long Replay::getSeed() {
+    return seed;
+}
+
+std::string Replay::getConfigString() {
+    return config;
+}
+
+long long Replay::getEvent() {
+    return event;
+}
+
+double Replay::getTime() {
+    return dirty ? sample_time : t;
+}
+
+bool Replay::step() {
+    if (file == nullptr) return false;
+    if (dirty) {
+        restore(sampled);
+        dirty = false;
+    }
+    long long from = event;
+    while (next())
+        if (event > from) return true;
+    return false;
+}
+
+// state right after the given number of events
+bool Replay::seek(long long event) {
+    if (file == nullptr || event < 0) return false;
+    if (dirty) {
+        restore(sampled);
+        dirty = false;
+    }
+    int k = (int)checkpoints.size() - 1;
+    while (k > 0 && checkpoints[k].event > event) k--;
+    if (event < this->event || checkpoints[k].event > this->event) restore(checkpoints[k]);
+    while (this->event < event && next());
+    return this->event == event;
+}
+
+// state at a physical time: the events up to it are applied and the particles then fly
+// freely for the remainder; false past the end of the log
+bool Replay::sampleAt(double time) {
+    if (file == nullptr || time < 0) return false;
+    if (dirty) {
+        restore(sampled);
+        dirty = false;
+    }
+    int k = (int)checkpoints.size() - 1;
+    while (k > 0 && checkpoints[k].t > time) k--;
+    if (time < t || checkpoints[k].event > event) restore(checkpoints[k]);
+
+    bool more = true;
+    while (true) {
+        size_t at = offset;
+        unsigned long long a, b;
+        double dt;
+        more = getVarint(a) && getVarint(b) && getBytes(&dt, sizeof(double));
+        offset = at;
+        if (!more || t + dt > time) break;
+        next();
+    }
+    save(sampled);
+    for (int l = walls_len; l < objs_len; l++) objs[l]->progress(time - t);
+    sample_time = time;
+    dirty = true;
+    return more;
+}
+
+Replay::~Replay() {
+    if (objs != nullptr) {
+        for (int l = 0; l < objs_len; l++) {
+            if (objs[l] == nullptr) continue;
+            if (PhObject::isParticle(objs[l])) objs[l]->~PhObject();
+            else delete objs[l];
+        }
+        delete[] objs;
+    }
+    ::operator delete(particles_pool);
+    if (file != nullptr) delete file;
+}
@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include "geometry.h"
+#include "mappedfile.h"
+#ifndef H_EVENTLOG
+#define H_EVENTLOG
+
+#define EVENTLOG_MAGIC "IGSLOG01"
+#define EVENTLOG_BUFFER (1 << 20)
+#define REPLAY_CHECKPOINT 65536
+
+// header: magic, dim, walls, particles, seed, config string, walls, particles at t = 0;
+// then per processed event the varint external ids of both objects and the raw time step.
+// external ids are the wall slots followed by walls_len + Particle2D/3D::getIndex(). a record
+// with both ids equal is a stretch of free flight without a collision (Simulation::advanceTo)
+class EventLog {
+protected:
+	std::ofstream out;
+	std::vector<char> buffer;
+	void putVarint(unsigned long long v);
+	void putDouble(double d);
+	void putInt(int i);
+
+public:
+	EventLog(std::string path);
+	bool isOpen();
+	void flush();
+	void writeHeader(PhObject** objs, int objs_len, int walls_len, unsigned long long seed, std::string config);
+	void writeEvent(int a, int b, double dt);
+	~EventLog();
+};
+
+// rebuilds the state of a logged run by applying the logged collisions; nothing is predicted
+class Replay {
+protected:
+	struct Checkpoint {
+		long long event;
+		size_t offset;
+		double t;
+		std::vector<double> state;
+	};
+	MappedFile* file;
+	size_t offset;
+	int dim, walls_len, objs_len;
+	unsigned long long seed;
+	std::string config;
+	PhObject** objs;
+	void* particles_pool;
+	long long event;
+	double t;
+	std::vector<Checkpoint> checkpoints;
+	Checkpoint sampled;
+	double sample_time;
+	bool dirty;
+	bool getVarint(unsigned long long& v);
+	bool getBytes(void* to, size_t n);
+	bool readHeader();
+	bool next();
+	void save(Checkpoint& cp);
+	void restore(Checkpoint& cp);
+
+public:
+	Replay(std::string path);
+	bool isOpen();
+	int getDimension();
+	int getObjectsLen();
+	int getWallsLen();
+	PhObject** getObjects();
+	unsigned long long getSeed();
+	std::string getConfigString();
+	long long getEvent();
+	double getTime();
+	bool step();
+	bool seek(long long event);
+	bool sampleAt(double time);
+	~Replay();
+};
+
+#endif
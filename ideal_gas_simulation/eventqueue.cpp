@@ -0,0 +1,73 @@
+#include "eventqueue.h"
+#include <algorithm>
+
+MultisetEventQueue::MultisetEventQueue() : events(Event::compare) {
+}
+
+// the range constructor is linear for sorted input
+void MultisetEventQueue::build(Event** events, long long n) {
+    std::vector<Event*> sorted(events, events + n);
+    std::sort(sorted.begin(), sorted.end(), Event::compare);
+    this->events = std::multiset<Event*, decltype(Event::compare)*>(sorted.begin(), sorted.end(), Event::compare);
+}
+
+Event* MultisetEventQueue::top() {
+    return *events.begin();
+}
+
+void MultisetEventQueue::update(Event* e, double t, double dt) {
+    auto it = events.find(e);
+    if (it != events.end()) {
+        while (*it != e) ++it;
+        events.erase(it);
+    }
+    e->t = t;
+    e->dt = dt;
+    events.insert(e);
+}
+
+void HeapEventQueue::place(int i, Event* e) {
+    heap[i] = e;
+    e->heap_index = i;
+}
+
+void HeapEventQueue::siftUp(int i) {
+    Event* e = heap[i];
+    while (i > 0 && Event::compare(e, heap[(i - 1) / 2])) {
+        place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    place(i, e);
+}
+
+void HeapEventQueue::siftDown(int i) {
+    Event* e = heap[i];
+    int n = (int)heap.size();
+    while (2 * i + 1 < n) {
+        int c = 2 * i + 1;
+        if (c + 1 < n && Event::compare(heap[c + 1], heap[c])) c++;
+        if (!Event::compare(heap[c], e)) break;
+        place(i, heap[c]);
+        i = c;
+    }
+    place(i, e);
+}
+
+// Floyd's bottom-up construction, O(n)
+void HeapEventQueue::build(Event** events, long long n) {
+    heap.assign(events, events + n);
+    for (int l = 0; l < (int)n; l++) heap[l]->heap_index = l;
+    for (int l = (int)n / 2 - 1; l >= 0; l--) siftDown(l);
+}
+
+Event* HeapEventQueue::top() {
+    return heap[0];
+}
+
+void HeapEventQueue::update(Event* e, double t, double dt) {
+    e->t = t;
+    e->dt = dt;
+    int i = e->heap_index;
+    if (i > 0 && Event::compare(e, heap[(i - 1) / 2])) siftUp(i);
+    else siftDown(i);
+}
@@ -0,0 +1,41 @@
+#include <set>
+#include <vector>
+#include "geometry.h"
+#ifndef H_EVENTQUEUE
+#define H_EVENTQUEUE
+
+// pending events ordered by Event::compare; keys change only through update()
+class EventQueue {
+public:
+	virtual void build(Event** events, long long n) = 0;
+	virtual Event* top() = 0;
+	virtual void update(Event* e, double t, double dt) = 0;
+	virtual ~EventQueue() {}
+};
+
+class MultisetEventQueue : public EventQueue {
+protected:
+	std::multiset<Event*, decltype(Event::compare)*> events;
+
+public:
+	MultisetEventQueue();
+	void build(Event** events, long long n);
+	Event* top();
+	void update(Event* e, double t, double dt);
+};
+
+// binary heap; every event keeps its own position, so updates need no search
+class HeapEventQueue : public EventQueue {
+protected:
+	std::vector<Event*> heap;
+	void place(int i, Event* e);
+	void siftUp(int i);
+	void siftDown(int i);
+
+public:
+	void build(Event** events, long long n);
+	Event* top();
+	void update(Event* e, double t, double dt);
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "fields.h"
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <algorithm>
+
+// species[i] is the group of particle i and mass[g] the mass of group g; lo and hi bound the
+// container
+FieldGrid::FieldGrid(int dim, std::vector<int>& species, std::vector<double>& mass, double* lo, double* hi, int resolution, double kB) {
+    this->dim = dim;
+    this->n = (int)species.size();
+    this->groups = (int)mass.size();
+    this->species = species;
+    this->mass = mass;
+    this->resolution = resolution > 0 ? resolution : 1;
+    this->kB = kB;
+    bins = 1;
+    for (int k = 0; k < 3; k++) {
+        this->lo[k] = k < dim ? lo[k] : 0;
+        this->hi[k] = k < dim ? hi[k] : 0;
+        bin_size[k] = k < dim ? (hi[k] - lo[k]) / this->resolution : 1;
+        if (k < dim) bins *= this->resolution;
+    }
+    last.assign(n, 0);
+    time.assign((size_t)groups * bins, 0);
+    momentum.assign((size_t)groups * bins * dim, 0);
+    square.assign((size_t)groups * bins, 0);
+    window_start = 0;
+}
+
+// c is the start of the path; bins are left in the order of the axis boundary times, so a
+// path crossing b bins costs O(b)
+void FieldGrid::segment(int group, const double* c, const double* v, double dt) {
+    int cell[3], step[3];
+    double next[3], delta[3], v2 = 0;
+    for (int k = 0; k < dim; k++) {
+        int i = (int)floor((c[k] - lo[k]) / bin_size[k]);
+        cell[k] = i < 0 ? 0 : (i >= resolution ? resolution - 1 : i);
+        step[k] = v[k] > 0 ? 1 : -1;
+        double boundary = lo[k] + (cell[k] + (v[k] > 0 ? 1 : 0)) * bin_size[k];
+        next[k] = v[k] != 0 ? (boundary - c[k]) / v[k] : INFINITY;
+        delta[k] = v[k] != 0 ? bin_size[k] / fabs(v[k]) : INFINITY;
+        v2 += v[k] * v[k];
+    }
+    double t = 0;
+    while (t < dt) {
+        int axis = 0;
+        for (int k = 1; k < dim; k++) if (next[k] < next[axis]) axis = k;
+        double exit = next[axis] < dt ? next[axis] : dt, tau = exit > t ? exit - t : 0;
+        int bin = 0;
+        for (int k = dim - 1; k >= 0; k--) bin = bin * resolution + cell[k];
+        size_t g = (size_t)group * bins + bin;
+        time[g] += tau;
+        for (int k = 0; k < dim; k++) momentum[g * dim + k] += v[k] * tau;
+        square[g] += v2 * tau;
+        t = exit;
+        if (exit >= dt) break;
+        // rounding at the walls can ask for a bin outside the grid; the rest stays in the last one
+        if (cell[axis] + step[axis] < 0 || cell[axis] + step[axis] >= resolution) next[axis] = INFINITY;
+        else {
+            cell[axis] += step[axis];
+            next[axis] += delta[axis];
+        }
+    }
+}
+
+// c and v are the particle's position and velocity at t; the velocity has to be the one it
+// had since the last flush
+void FieldGrid::flush(int index, const double* c, const double* v, double t) {
+    double dt = t - last[index], start[3];
+    if (dt > 0) {
+        for (int k = 0; k < dim; k++) start[k] = c[k] - v[k] * dt;
+        segment(species[index], start, v, dt);
+    }
+    last[index] = t;
+}
+
+int FieldGrid::getBinCount() {
+    return bins;
+}
+
+// of the window ending at t, which all particles must have been flushed to: number density,
+// dim components of the mean velocity and m <|v - u|^2> / (dim kB) per bin; empty bins are 0
+void FieldGrid::getFields(int group, double t, std::vector<double>& density, std::vector<double>& velocity, std::vector<double>& temperature) {
+    double window = t - window_start, volume = 1;
+    for (int k = 0; k < dim; k++) volume *= bin_size[k];
+    density.assign(bins, 0);
+    velocity.assign((size_t)bins * dim, 0);
+    temperature.assign(bins, 0);
+    for (int b = 0; b < bins; b++) {
+        size_t g = (size_t)group * bins + b;
+        if (time[g] <= 0 || window <= 0) continue;
+        density[b] = time[g] / (window * volume);
+        double u2 = 0;
+        for (int k = 0; k < dim; k++) {
+            velocity[(size_t)b * dim + k] = momentum[g * dim + k] / time[g];
+            u2 += velocity[(size_t)b * dim + k] * velocity[(size_t)b * dim + k];
+        }
+        double fluctuation = square[g] / time[g] - u2;
+        temperature[b] = mass[group] * (fluctuation > 0 ? fluctuation : 0) / (dim * kB);
+    }
+}
+
+// appends one frame: int32 dim, resolution and groups, the window start and end as doubles,
+// then per group the density, velocity and temperature arrays as doubles, bin index
+// x-fastest
+bool FieldGrid::write(std::string path, double t) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    if (!out.is_open()) {
+        std::cerr << "Cannot write fields " << path << std::endl;
+        return false;
+    }
+    int header[3] = { dim, resolution, groups };
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)&window_start, sizeof(double));
+    out.write((const char*)&t, sizeof(double));
+    std::vector<double> density, velocity, temperature;
+    for (int g = 0; g < groups; g++) {
+        getFields(g, t, density, velocity, temperature);
+        out.write((const char*)density.data(), density.size() * sizeof(double));
+        out.write((const char*)velocity.data(), velocity.size() * sizeof(double));
+        out.write((const char*)temperature.data(), temperature.size() * sizeof(double));
+    }
+    return out.good();
+}
+
+void FieldGrid::reset(double t) {
+    std::fill(time.begin(), time.end(), 0);
+    std::fill(momentum.begin(), momentum.end(), 0);
+    std::fill(square.begin(), square.end(), 0);
+    window_start = t;
+}
@@ -0,0 +1,30 @@
+#include <string>
+#include <vector>
+#ifndef H_FIELDS
+#define H_FIELDS
+
+// coarse grained density, mean velocity and kinetic temperature per species on a grid of
+// resolution^dim bins. every particle is flushed only when its velocity is about to change
+// (its events) or at the end of a window: its straight path since the last flush is walked
+// through the bins it crossed, adding the residence time, the time integral of v and of v^2.
+// the cost is thus per event and per bin crossed, plus O(N) per window
+class FieldGrid {
+protected:
+	int dim, n, groups, resolution, bins;
+	double kB, lo[3], hi[3], bin_size[3], window_start;
+	std::vector<int> species;
+	std::vector<double> mass;
+	std::vector<double> last;
+	std::vector<double> time, momentum, square;
+	void segment(int group, const double* c, const double* v, double dt);
+
+public:
+	FieldGrid(int dim, std::vector<int>& species, std::vector<double>& mass, double* lo, double* hi, int resolution, double kB);
+	void flush(int index, const double* c, const double* v, double t);
+	int getBinCount();
+	void getFields(int group, double t, std::vector<double>& density, std::vector<double>& velocity, std::vector<double>& temperature);
+	bool write(std::string path, double t);
+	void reset(double t);
+};
+
+#endif
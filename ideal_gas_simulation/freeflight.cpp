@@ -0,0 +1,80 @@
+#include "freeflight.h"
+#include <math.h>
+
+#define FREE_FLIGHT_CHUNK 4096
+
+// positions and velocities are ordered by particle index, radius and mass by particle
+FreeFlight::FreeFlight(int dim, const std::vector<double>& positions, const std::vector<double>& velocities, const std::vector<double>& radius, const std::vector<double>& mass, double hfw, int threads) {
+    this->dim = dim;
+    n = (int)radius.size();
+    int coords = n * dim;
+    u.resize(coords);
+    v.resize(coords);
+    lo.resize(coords);
+    length.resize(coords);
+    inv.resize(coords);
+    w.resize(coords);
+    for (int l = 0; l < coords; l++) {
+        double r = radius[l / dim];
+        lo[l] = -hfw + r;
+        length[l] = 2 * (hfw - r);
+        inv[l] = 1 / length[l];
+        u[l] = positions[l] - lo[l];
+        v[l] = velocities[l];
+        // momentum handed to the wall per hit
+        w[l] = 2 * mass[l / dim] * fabs(v[l]);
+    }
+    chunks = (coords + FREE_FLIGHT_CHUNK - 1) / FREE_FLIGHT_CHUNK;
+    chunk_dp.assign(chunks, 0);
+    chunk_hits.assign(chunks, 0);
+    pool = new ThreadPool(threads);
+}
+
+// expected hits per unit time over all walls, |v| / L per coordinate
+double FreeFlight::getHitRate() {
+    double rate = 0;
+    for (size_t l = 0; l < v.size(); l++) rate += fabs(v[l]) * inv[l];
+    return rate;
+}
+
+// the floors count the multiples of L in [0, u); their difference is the number of hits
+// whichever way the particle moves. no branches, so the loop vectorises
+void FreeFlight::countChunk(int chunk, double t0, double t1) {
+    int from = chunk * FREE_FLIGHT_CHUNK, to = from + FREE_FLIGHT_CHUNK < (int)u.size() ? from + FREE_FLIGHT_CHUNK : (int)u.size();
+    double dp = 0, hits = 0;
+    for (int l = from; l < to; l++) {
+        double k = fabs(floor((u[l] + v[l] * t1) * inv[l]) - floor((u[l] + v[l] * t0) * inv[l]));
+        dp += k * w[l];
+        hits += k;
+    }
+    chunk_dp[chunk] = dp;
+    chunk_hits[chunk] = hits;
+}
+
+// total momentum given to the walls in (t0, t1], times measured from the start of the flight
+double FreeFlight::impulse(double t0, double t1, long long& hits) {
+    for (int c = 0; c < chunks; c++) pool->submit([this, c, t0, t1]() { countChunk(c, t0, t1); });
+    pool->wait();
+    double dp = 0, count = 0;
+    for (int c = 0; c < chunks; c++) {
+        dp += chunk_dp[c];
+        count += chunk_hits[c];
+    }
+    hits = (long long)count;
+    return dp;
+}
+
+// folds u into [0, 2L): the first half is the way out, the second the way back
+void FreeFlight::stateAt(double t, double* positions, double* velocities) {
+    for (size_t l = 0; l < u.size(); l++) {
+        double period = 2 * length[l], f = u[l] + v[l] * t;
+        f -= period * floor(f / period);
+        bool back = f > length[l];
+        positions[l] = lo[l] + (back ? period - f : f);
+        velocities[l] = back ? -v[l] : v[l];
+    }
+}
+
+FreeFlight::~FreeFlight() {
+    delete pool;
+}
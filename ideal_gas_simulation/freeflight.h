@@ -0,0 +1,27 @@
+#include <vector>
+#include "threadpool.h"
+#ifndef H_FREEFLIGHT
+#define H_FREEFLIGHT
+
+// particles that never meet each other, in the box [-hfw, hfw]^dim. along every axis a particle
+// moves on the unfolded line u = u0 + v t, and its position is u folded into [0, L] with
+// L = 2 (hfw - r); the wall hits in (t0, t1] are the multiples of L passed by u, so the impulse
+// over any interval is O(N) whatever the number of hits. coordinates are stored flat, dim per
+// particle, and are cut into fixed chunks for the pool so that sums do not depend on threads
+class FreeFlight {
+protected:
+	int n, dim, chunks;
+	std::vector<double> u, v, lo, length, inv, w;
+	std::vector<double> chunk_dp, chunk_hits;
+	ThreadPool* pool;
+	void countChunk(int chunk, double t0, double t1);
+
+public:
+	FreeFlight(int dim, const std::vector<double>& positions, const std::vector<double>& velocities, const std::vector<double>& radius, const std::vector<double>& mass, double hfw, int threads);
+	double getHitRate();
+	double impulse(double t0, double t1, long long& hits);
+	void stateAt(double t, double* positions, double* velocities);
+	~FreeFlight();
+};
+
+#endif
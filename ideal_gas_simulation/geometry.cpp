@@ -1,22 +1,79 @@
 #include "geometry.h"
+#include "statistics.h"
+#include "snapshot.h"
+#include "eventqueue.h"
+#include "eventlog.h"
+#include "correlator.h"
+#include "structure.h"
+#include "freeflight.h"
+#include "fields.h"
+#include "monitor.h"
+#include "arena.h"
 #include <math.h>
 #include <string>
 #include <sstream>
 #include <algorithm>
 #include <random>
 #include <chrono>
-#include <set>
-//#include <iostream>
+#include <thread>
+#include <new>
+#include <fstream>
+#include <iostream>
 
 #define SQR(a) (a * a)
 #define COLL_A(a, b) ((a - b) * (a - b))
 #define COLL_B(c_1, v_1, c_2, v_2) ((c_1 - c_2) * (v_1 - v_2))
+#define MSER_BATCH 5
+#define MIN_PRODUCTION_STEPS 32
+#define PI 3.14159265358979323846
+#define CONTACT_TOLERANCE 1e-9
+#define PARALLEL_MIN_PAIRS 65536
+#define MORTON_BITS_2D 16
+#define MORTON_BITS_3D 10
+
+// earliest t >= 0 at which |d + v t| = r while approaching; cross2 = |d x v|^2 is passed
+// separately because vv * dd - dv * dv cancels badly when r is tiny compared to |d|
+static double approachTime(double vv, double dv, double dd, double cross2, double rr) {
+    if (dv >= 0 || vv == 0) return NOT_COLLIDING;
+    if (dd <= rr) return 0;
+    double disc = vv * rr - cross2;
+    if (disc < 0) return NOT_COLLIDING;
+    return (-dv - sqrt(disc)) / vv;
+}
+
+// centre and velocity of a particle, zero padded to three components; the config carries
+// its id, radius and mass
+static ParticleConfig particleState(PhObject* o, double* c, double* v) {
+    Vec3 pc, pv;
+    ParticleConfig config(0, 0, 0);
+    if (o->getType() == PARTICLE_3D) {
+        Particle3D* p = static_cast<Particle3D*>(o);
+        pc = p->getCenter()->vec();
+        pv = p->getVelocity()->vec();
+        config = ParticleConfig(p->getId(), p->getRadius(), p->getMass());
+    }
+    else {
+        Particle2D* p = static_cast<Particle2D*>(o);
+        Vec2 c2 = p->getCenter()->vec(), v2 = p->getVelocity()->vec();
+        pc = Vec3(c2.x, c2.y, 0);
+        pv = Vec3(v2.x, v2.y, 0);
+        config = ParticleConfig(p->getId(), p->getRadius(), p->getMass());
+    }
+    c[0] = pc.x;
+    c[1] = pc.y;
+    c[2] = pc.z;
+    v[0] = pv.x;
+    v[1] = pv.y;
+    v[2] = pv.z;
+    return config;
+}
 
 Event::Event() {
     this->o1 = NULL;
     this->o2 = NULL;
     this->t = 0;
     this->dt = 0;
+    this->heap_index = -1;
 }
 
 Event::Event(PhObject* o1, PhObject* o2, double t, double dt) {
@@ -24,6 +81,7 @@ Event::Event(PhObject* o1, PhObject* o2, double t, double dt) {
     this->o2 = o2;
     this->t = t;
     this->dt = dt;
+    this->heap_index = -1;
 }
 
 bool Event::compare(Event* e1, Event* e2) {
@@ -40,35 +98,6 @@ bool Event::compare(Event* e1, Event* e2) {
     return e1->t + e1->dt < e2->t + e2->dt;*/
 }
 
-Point2D::Point2D(double x, double y) {
-    this->x = x;
-    this->y = y;
-}
-
-Point2D::Point2D(Point2D* p) {
-    this->x = p->x;
-    this->y = p->y;
-}
-
-double Point2D::getX() {
-    return this->x;
-}
-
-double Point2D::getY() {
-    return this->y;
-}
-
-void Point2D::set(double x, double y) {
-    this->x = x;
-    this->y = y;
-}
-
-void Point2D::add(double dx, double dy) {
-    this->x += dx;
-    this->y += dy;
-}
-
-
 std::string Point2D::toString() {
     std::ostringstream ssx, ssy;
     ssx << std::scientific << this->x;
@@ -80,43 +109,6 @@ double Point2D::distance(Point2D* p1, Point2D* p2) {
     return sqrt(COLL_A(p1->x, p2->x) + COLL_A(p1->y, p2->y));
 }
 
-Point3D::Point3D(double x, double y, double z) {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-}
-
-Point3D::Point3D(Point3D* p) {
-    this->x = p->x;
-    this->y = p->y;
-    this->z = p->z;
-}
-
-double Point3D::getX() {
-    return this->x;
-}
-
-double Point3D::getY() {
-    return this->y;
-}
-
-double Point3D::getZ() {
-    return this->z;
-}
-
-void Point3D::set(double x, double y, double z) {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-}
-
-void Point3D::add(double dx, double dy, double dz) {
-    this->x += dx;
-    this->y += dy;
-    this->z += dz;
-}
-
-
 std::string Point3D::toString() {
     std::ostringstream ssx, ssy, ssz;
     ssx << std::scientific << this->x;
@@ -129,9 +121,10 @@ double Point3D::distance(Point3D* p1, Point3D* p2) {
     return sqrt(COLL_A(p1->x, p2->x) + COLL_A(p1->y, p2->y) + COLL_A(p1->z, p2->z));
 }
 
-void PhObject::initEvents(int n) {
+// the table belongs to whoever allocated it, the simulation's arena
+void PhObject::initEvents(int n, Event** events) {
     this->events_n = n;
-    this->events = new Event * [n];
+    this->events = events;
 }
 
 Event** PhObject::getEvents() {
@@ -149,172 +142,70 @@ PhObject::PhObject() {
 
 double PhObject::collision(PhObject* o1, PhObject* o2, double act) {
     double t = act;
-    if (o1->getType() == LINE_2D && o2->getType() == LINE_2D) return NOT_COLLIDING;
+    if (!isParticle(o1) && !isParticle(o2)) return NOT_COLLIDING;
     else if ((o1->getType() == LINE_2D && o2->getType() == PARTICLE_2D) ||
         (o1->getType() == PARTICLE_2D && o2->getType() == LINE_2D)) {
         Line2D* sw = static_cast<Line2D*>(o1->getType() == LINE_2D ? o1 : o2);
         Particle2D* p = static_cast<Particle2D*>(o1->getType() == LINE_2D ? o2 : o1);
-        Point2D* p1 = sw->getFirstPoint(), * p2 = sw->getSecondPoint(), * ctr = p->getCenter();
-        Vector2D* v = p->getVelocity();
-
-        Vector2D tang(p1, p2, true),
-            d(ctr, p2),
-            ort(-tang.getY(), tang.getX()),
-            ortsw = Vector2D::projection(&d, &ort),
-            ortv = Vector2D::projection(v, &ort);
-        if (act < -0.5) {
-            if (ortsw.getX() * ortv.getX() + ortsw.getY() * ortv.getY() <= 0) {
-                //std::cout << triangle->toString() << " " << v->toString() << std::endl;
-                //std::cout << orttriangle.toString() << " " << ortv.toString() << std::endl << std::endl;
-                return NOT_COLLIDING;
-            }
-            else {
-                t = (ortsw.len() - p->getRadius()) / ortv.len();
-                if (t <= 0) return NOT_COLLIDING;
-            }
-        }
-        else {
-
-            Vector2D tangv = Vector2D::projection(v, &tang);
-            ortv.multiply(-1);
-            v->set(tangv.getX() + ortv.getX(), tangv.getY() + ortv.getY());
-
-            //std::cout << triangle->toString() << std::endl;
-            t = 2 * p->getMass() * ortv.len();
-        }
+        if (act < -0.5) return sw->hitTime(p);
+        else t = sw->reflect(p);
+    }
+    else if ((o1->getType() == CONTAINER_2D && o2->getType() == PARTICLE_2D) ||
+        (o1->getType() == PARTICLE_2D && o2->getType() == CONTAINER_2D)) {
+        Container2D* box = static_cast<Container2D*>(o1->getType() == CONTAINER_2D ? o1 : o2);
+        Particle2D* p = static_cast<Particle2D*>(o1->getType() == CONTAINER_2D ? o2 : o1);
+        if (act < -0.5) return box->hitTime(p);
+        else t = box->reflect(p);
     }
     else if (o1->getType() == PARTICLE_2D && o2->getType() == PARTICLE_2D) {
         Particle2D* p1 = static_cast<Particle2D*>(o1), * p2 = static_cast<Particle2D*>(o2);
-        Vector2D* v1 = p1->getVelocity(), * v2 = p2->getVelocity();
-        Point2D* c1 = p1->getCenter(), * c2 = p2->getCenter();
+        Vec2 d = p1->getCenter()->vec() - p2->getCenter()->vec(), v = p1->getVelocity()->vec() - p2->getVelocity()->vec();
         if (act < -0.5) {
-            if (Point2D::distance(c1, c2) < p1->getRadius() + p2->getRadius()) return INSIDE_EACH_OTHER;
-            else if (Point2D::distance(c1, c2) == p1->getRadius() + p2->getRadius()) {
-                Vector2D d(c1, c2, true),
-                    tang1 = Vector2D::projection(v1, &d),
-                    tang2 = Vector2D::projection(v2, &d),
-                    tangs = Vector2D::sub(&tang1, &tang2);
-                if (tangs.len() == 0 || (c1->getX() != c2->getX() && tangs.getX() / (c1->getX() - c2->getX()) < 0) || (c1->getY() != c2->getY() && tangs.getY() / (c1->getY() - c2->getY()) < 0)) return NOT_COLLIDING;
-            }
-            double a = COLL_A(v1->getX(), v2->getX()) + COLL_A(v1->getY(), v2->getY()),
-                b = 2 * (COLL_B(c1->getX(), v1->getX(), c2->getX(), v2->getX()) + COLL_B(c1->getY(), v1->getY(), c2->getY(), v2->getY())),
-                c = COLL_A(c1->getX(), c2->getX()) + COLL_A(c1->getY(), c2->getY()) - COLL_A(p1->getRadius(), -p2->getRadius());
-            if (b * b - 4 * a * c < 0) return NOT_COLLIDING;
-            double t1 = (-b - sqrt(b * b - 4 * a * c)) / 2 / a,
-                t2 = (-b + sqrt(b * b - 4 * a * c)) / 2 / a;
-            if (t1 < 0 && t2 < 0) return NOT_COLLIDING;
-            else t = (t1 < 0) ? t2 : t1;
-            if (t <= 0) { // check if going to collide or get away
-                t = 0;
-                Vector2D d(c1, c2, true),
-                    tang1 = Vector2D::projection(v1, &d),
-                    tang2 = Vector2D::projection(v2, &d),
-                    tangs = Vector2D::sub(&tang1, &tang2);
-                //std::cout << v1->toString() << " " << v2->toString() << std::endl;
-                if (tangs.len() == 0 || (c1->getX() != c2->getX() && tangs.getX() / (c1->getX() - c2->getX()) < 0) || (c1->getY() != c2->getY() && tangs.getY() / (c1->getY() - c2->getY()) < 0)) return NOT_COLLIDING;
-            }
-            //else if (t < 0) return INSIDE_EACH_OTHER; // quantisation error
+            // the earlier quadratic took the exit root for touching pairs, so a pair that had
+            // just collided was scheduled again and bounced in place forever
+            double rr = p1->getRadius() + p2->getRadius(), cr = cross(d, v);
+            return approachTime(dot(v, v), dot(d, v), dot(d, d), cr * cr, rr * rr);
         }
         else {
-            Vector2D tang(c1, c2, true),
-                ort(-tang.getY(), tang.getX()),
-                tang1 = Vector2D::projection(v1, &tang),
-                tang2 = Vector2D::projection(v2, &tang),
-                ort1 = Vector2D::projection(v1, &ort),
-                ort2 = Vector2D::projection(v2, &ort);
-            double m1 = p1->getMass(), m2 = p2->getMass(),
-                a11 = (m1 - m2) / (m1 + m2), a12 = 2 * m2 / (m1 + m2),
-                a21 = 2 * m1 / (m1 + m2), a22 = (m2 - m1) / (m1 + m2);
-            v1->set(a11 * tang1.getX() + a12 * tang2.getX() + ort1.getX(), a11 * tang1.getY() + a12 * tang2.getY() + ort1.getY());
-            v2->set(a21 * tang1.getX() + a22 * tang2.getX() + ort2.getX(), a21 * tang1.getY() + a22 * tang2.getY() + ort2.getY());
-
+            // the velocities change only along the line of centres, by the impulse
+            // 2 m1 m2 / (m1 + m2) (v . d) d / |d|^2, so no unit vector and no sqrt is needed
+            double m1 = p1->getMass(), m2 = p2->getMass(), dd = dot(d, d);
+            if (dd > 0) {
+                Vec2 j = d * (2 * dot(v, d) / (dd * (m1 + m2)));
+                p1->getVelocity()->set(p1->getVelocity()->vec() - j * m2);
+                p2->getVelocity()->set(p2->getVelocity()->vec() + j * m1);
+            }
             t = 0; // promena impulsa nula
         }
     }
-    else if (o1->getType() == TRIANGLE && o2->getType() == TRIANGLE) return NOT_COLLIDING;
     else if ((o1->getType() == TRIANGLE && o2->getType() == PARTICLE_3D) ||
         (o1->getType() == PARTICLE_3D && o2->getType() == TRIANGLE)) {
         Triangle* triangle = static_cast<Triangle*>(o1->getType() == TRIANGLE ? o1 : o2);
         Particle3D* p = static_cast<Particle3D*>(o1->getType() == TRIANGLE ? o2 : o1);
-        Point3D* p1 = triangle->getFirstPoint(), * p2 = triangle->getSecondPoint(), * p3 = triangle->getThirdPoint(), * ctr = p->getCenter();
-        Vector3D* v = p->getVelocity();
-
-        Vector3D a(p1, p2, true),
-            b(p1, p3, true),
-            d1(ctr, p2),
-            ort = Vector3D::vector(&a, &b, true),
-            orttriangle = Vector3D::projection(&d1, &ort),
-            ortv = Vector3D::projection(v, &ort);
-
-        if (act < -0.5) {
-            if (orttriangle.getX() * ortv.getX() + orttriangle.getY() * ortv.getY() + orttriangle.getZ() * ortv.getZ() <= 0) {
-                //std::cout << triangle->toString() << " " << v->toString() << std::endl;
-                //std::cout << orttriangle.toString() << " " << ortv.toString() << std::endl << std::endl;
-                return NOT_COLLIDING;
-            }
-            else {
-                t = (orttriangle.len() - p->getRadius()) / ortv.len();
-                if (t <= 0) return NOT_COLLIDING;
-            }
-        }
-        else {
-            Vector3D tangv = Vector3D::sub(v, &ortv);
-            ortv.multiply(-1);
-            v->set(tangv.getX() + ortv.getX(), tangv.getY() + ortv.getY(), tangv.getZ() + ortv.getZ());
-
-            //std::cout << triangle->toString() << std::endl;
-            t = 2 * p->getMass() * ortv.len();
-        }
+        if (act < -0.5) return triangle->hitTime(p);
+        else t = triangle->reflect(p);
+    }
+    else if ((o1->getType() == CONTAINER_3D && o2->getType() == PARTICLE_3D) ||
+        (o1->getType() == PARTICLE_3D && o2->getType() == CONTAINER_3D)) {
+        Container3D* box = static_cast<Container3D*>(o1->getType() == CONTAINER_3D ? o1 : o2);
+        Particle3D* p = static_cast<Particle3D*>(o1->getType() == CONTAINER_3D ? o2 : o1);
+        if (act < -0.5) return box->hitTime(p);
+        else t = box->reflect(p);
     }
     else if (o1->getType() == PARTICLE_3D && o2->getType() == PARTICLE_3D) {
         Particle3D* p1 = static_cast<Particle3D*>(o1), * p2 = static_cast<Particle3D*>(o2);
-        Vector3D* v1 = p1->getVelocity(), * v2 = p2->getVelocity();
-        Point3D* c1 = p1->getCenter(), * c2 = p2->getCenter();
+        Vec3 d = p1->getCenter()->vec() - p2->getCenter()->vec(), v = p1->getVelocity()->vec() - p2->getVelocity()->vec();
         if (act < -0.5) {
-            if (Point3D::distance(c1, c2) < p1->getRadius() + p2->getRadius()) return INSIDE_EACH_OTHER;
-            else if (Point3D::distance(c1, c2) == p1->getRadius() + p2->getRadius()) {
-                Vector3D d(c1, c2, true),
-                    tang1 = Vector3D::projection(v1, &d),
-                    tang2 = Vector3D::projection(v2, &d),
-                    tangs = Vector3D::sub(&tang1, &tang2);
-                if (tangs.len() == 0 || (c1->getX() != c2->getX() && tangs.getX() / (c1->getX() - c2->getX()) < 0) || (c1->getY() != c2->getY() && tangs.getY() / (c1->getY() - c2->getY()) < 0) || (c1->getZ() != c2->getZ() && tangs.getZ() / (c1->getZ() - c2->getZ()) < 0)) return NOT_COLLIDING;
-            }
-            double a = COLL_A(v1->getX(), v2->getX()) + COLL_A(v1->getY(), v2->getY()) + COLL_A(v1->getZ(), v2->getZ()),
-                b = 2 * (COLL_B(c1->getX(), v1->getX(), c2->getX(), v2->getX()) + COLL_B(c1->getY(), v1->getY(), c2->getY(), v2->getY()) + COLL_B(c1->getZ(), v1->getZ(), c2->getZ(), v2->getZ())),
-                c = COLL_A(c1->getX(), c2->getX()) + COLL_A(c1->getY(), c2->getY()) + COLL_A(c1->getZ(), c2->getZ()) - COLL_A(p1->getRadius(), -p2->getRadius());
-            if (b * b - 4 * a * c < 0) return NOT_COLLIDING;
-            double t1 = (-b - sqrt(b * b - 4 * a * c)) / 2 / a,
-                t2 = (-b + sqrt(b * b - 4 * a * c)) / 2 / a;
-            if (t1 < 0 && t2 < 0) return NOT_COLLIDING;
-            else t = (t1 < 0) ? t2 : t1;
-            if (t <= 0) { // check if going to collide or get away
-                t = 0;
-                Vector3D d(c1, c2, true),
-                    tang1 = Vector3D::projection(v1, &d),
-                    tang2 = Vector3D::projection(v2, &d),
-                    tangs = Vector3D::sub(&tang1, &tang2);
-                //std::cout << v1->toString() << " " << v2->toString() << std::endl;
-                if (tangs.len() == 0 || (c1->getX() != c2->getX() && tangs.getX() / (c1->getX() - c2->getX()) < 0) || (c1->getY() != c2->getY() && tangs.getY() / (c1->getY() - c2->getY()) < 0) || (c1->getZ() != c2->getZ() && tangs.getZ() / (c1->getZ() - c2->getZ()) < 0)) return NOT_COLLIDING;
-            }
-            //else if (t < 0) return INSIDE_EACH_OTHER; // quantisation error
+            double rr = p1->getRadius() + p2->getRadius();
+            return approachTime(dot(v, v), dot(d, v), dot(d, d), norm2(cross(d, v)), rr * rr);
         }
         else {
-            Vector3D tang(c1, c2, true),
-                tang1 = Vector3D::projection(v1, &tang),
-                tang2 = Vector3D::projection(v2, &tang),
-                ort1 = Vector3D::sub(v1, &tang1),
-                ort2 = Vector3D::sub(v2, &tang2);
-
-
-            double m1 = p1->getMass(), m2 = p2->getMass(),
-                a11 = (m1 - m2) / (m1 + m2), a12 = 2 * m2 / (m1 + m2),
-                a21 = 2 * m1 / (m1 + m2), a22 = (m2 - m1) / (m1 + m2);
-            v1->set(a11 * tang1.getX() + a12 * tang2.getX() + ort1.getX(), a11 * tang1.getY() + a12 * tang2.getY() + ort1.getY(), a11 * tang1.getZ() + a12 * tang2.getZ() + ort1.getZ());
-            v2->set(a21 * tang1.getX() + a22 * tang2.getX() + ort2.getX(), a21 * tang1.getY() + a22 * tang2.getY() + ort2.getY(), a21 * tang1.getZ() + a22 * tang2.getZ() + ort2.getZ());
-
-            //v1->set(tang2.getX() + ort1.getX(), tang2.getY() + ort1.getY(), tang2.getZ() + ort1.getZ()); // #TODO azurirati za razlicite mase, mada u eksperimentu nama nisu razlicite
-            //v2->set(tang1.getX() + ort2.getX(), tang1.getY() + ort2.getY(), tang1.getZ() + ort2.getZ());
-
+            double m1 = p1->getMass(), m2 = p2->getMass(), dd = dot(d, d);
+            if (dd > 0) {
+                Vec3 j = d * (2 * dot(v, d) / (dd * (m1 + m2)));
+                p1->getVelocity()->set(p1->getVelocity()->vec() - j * m2);
+                p2->getVelocity()->set(p2->getVelocity()->vec() + j * m1);
+            }
             t = 0; // promena impulsa nula
         }
     }
@@ -327,13 +218,27 @@ bool PhObject::compare(PhObject* o1, PhObject* o2) {
     return o1->events_n == 0 ? false : o2->events_n == 0 ? true : Event::compare(o1->events[0], o2->events[0]);
 }
 
+bool PhObject::isParticle(PhObject* o) {
+    return o->getType() == PARTICLE_2D || o->getType() == PARTICLE_3D;
+}
+
 PhObject::~PhObject() {
-    delete[] events;
+
+}
+
+Line2D::Line2D(Point2D* p1, Point2D* p2) : Line2D(p1, p2, 0) {
 }
 
-Line2D::Line2D(Point2D* p1, Point2D* p2) {
+// side +1/-1: the inside lies to the left/right of p1 -> p2, 0: both sides are open
+Line2D::Line2D(Point2D* p1, Point2D* p2, int side) {
     this->p1 = new Point2D(p1);
     this->p2 = new Point2D(p2);
+    this->side = side;
+    Vec2 e = p2->vec() - p1->vec();
+    length = sqrt(norm2(e));
+    unit = length > 0 ? e / length : e;
+    normal = perp(unit);
+    velocity = Vec2();
 }
 
 Point2D* Line2D::getFirstPoint() {
@@ -344,6 +249,19 @@ Point2D* Line2D::getSecondPoint() {
     return this->p2;
 }
 
+int Line2D::getSide() {
+    return this->side;
+}
+
+// a moving wall is translated rigidly, so the cached direction and normal stay valid
+void Line2D::setVelocity(double vx, double vy) {
+    velocity = Vec2(vx, vy);
+}
+
+Vec2 Line2D::getVelocity() {
+    return velocity;
+}
+
 TYPE Line2D::getType() {
     return LINE_2D;
 }
@@ -352,8 +270,73 @@ std::string Line2D::toString() {
     return "Line2D(" + this->p1->toString() + ", " + this->p2->toString() + ")";
 }
 
-void Line2D::progress(double t) {
+// the wall is at rest in its own frame, so a moving wall only changes the velocity used
+double Line2D::hitTime(Particle2D* p) {
+    Vec2 c = p->getCenter()->vec(), v = p->getVelocity()->vec() - velocity, d = c - p1->vec();
+    double r = p->getRadius(), best = NOT_COLLIDING,
+        s = dot(d, normal), vn = dot(v, normal);
+
+    if (side != 0) {
+        s *= side;
+        vn *= side;
+    }
+    // a one-sided wall also catches particles that rounding has pushed behind it
+    if ((side != 0 && vn < 0) || (side == 0 && s * vn < 0)) {
+        double t = (fabs(s) - r) / fabs(vn);
+        if (t < 0 || (side != 0 && s < 0)) t = 0;
+        double a = dot(d, unit) + dot(v, unit) * t;
+        if (a >= 0 && a <= length) best = t;
+    }
+
+    Vec2 ends[2] = { p1->vec(), p2->vec() };
+    double vv = dot(v, v);
+    for (int l = 0; l < 2; l++) {
+        Vec2 de = c - ends[l];
+        double cr = cross(de, v),
+            t = approachTime(vv, dot(de, v), dot(de, de), cr * cr, r * r);
+        if (t >= 0 && (best < 0 || t < best)) best = t;
+    }
+    return best;
+}
+
+Point2D Line2D::closestPoint(Point2D* c) {
+    double a = dot(c->vec() - p1->vec(), unit);
+    a = a < 0 ? 0 : a > length ? length : a;
+    Vec2 q = p1->vec() + unit * a;
+    return Point2D(q.x, q.y);
+}
+
+double Line2D::reflect(Particle2D* p) {
+    Vec2 c = p->getCenter()->vec(), v = p->getVelocity()->vec() - velocity, d = c - p1->vec(), n = normal;
+    double a = dot(d, unit), nn = 1, scale = 1;
+
+    // inside the segment the exact line normal is used; the closest point is only
+    // needed at the endpoints, where it is not swamped by rounding of the coordinates
+    if (side != 0) n *= side;
+    else if (dot(n, d) < 0 || (dot(n, d) == 0 && dot(n, v) > 0)) n = -n;
+    if (a <= 0 || a >= length) {
+        Point2D q = closestPoint(p->getCenter());
+        Vec2 nq = c - q.vec();
+        double qq = dot(nq, nq);
+        if (qq > 0 && (side == 0 || dot(nq, n) > 0)) {
+            n = nq;
+            nn = qq;
+            scale = sqrt(qq);
+        }
+    }
+
+    // v - 2 (v.n) n / |n|^2 needs no unit normal, only the impulse does; v is relative to
+    // the wall, so a moving wall transfers 2 m (v - u).n
+    double vn = dot(v, n);
+    if (vn >= 0) return 0;
+    p->getVelocity()->set(v + velocity - n * (2 * vn / nn));
+    return -2 * p->getMass() * vn / scale;
+}
 
+void Line2D::progress(double t) {
+    if (velocity.x == 0 && velocity.y == 0) return;
+    p1->set(p1->vec() + velocity * t);
+    p2->set(p2->vec() + velocity * t);
 }
 
 Line2D::~Line2D() {
@@ -361,10 +344,30 @@ Line2D::~Line2D() {
     delete p2;
 }
 
-Triangle::Triangle(Point3D* p1, Point3D* p2, Point3D* p3) {
+Triangle::Triangle(Point3D* p1, Point3D* p2, Point3D* p3) : Triangle(p1, p2, p3, 0) {
+}
+
+// side +1/-1: the inside lies along/against (p2 - p1) x (p3 - p1), 0: both sides are open
+Triangle::Triangle(Point3D* p1, Point3D* p2, Point3D* p3, int side) {
     this->p1 = new Point3D(p1);
     this->p2 = new Point3D(p2);
     this->p3 = new Point3D(p3);
+    this->side = side;
+    e1 = p2->vec() - p1->vec();
+    e2 = p3->vec() - p1->vec();
+    normal = cross(e1, e2);
+    if (norm2(normal) > 0) normal = normal / sqrt(norm2(normal));
+    d00 = dot(e1, e1);
+    d01 = dot(e1, e2);
+    d11 = dot(e2, e2);
+    den = d00 * d11 - d01 * d01;
+    Vec3 corners[3] = { p1->vec(), p2->vec(), p3->vec() };
+    for (int l = 0; l < 3; l++) {
+        Vec3 u = corners[(l + 1) % 3] - corners[l];
+        edge_length[l] = sqrt(norm2(u));
+        edge[l] = edge_length[l] > 0 ? u / edge_length[l] : u;
+    }
+    velocity = Vec3();
 }
 
 Point3D* Triangle::getFirstPoint() {
@@ -379,6 +382,18 @@ Point3D* Triangle::getThirdPoint() {
     return this->p3;
 }
 
+int Triangle::getSide() {
+    return this->side;
+}
+
+void Triangle::setVelocity(double vx, double vy, double vz) {
+    velocity = Vec3(vx, vy, vz);
+}
+
+Vec3 Triangle::getVelocity() {
+    return velocity;
+}
+
 TYPE Triangle::getType() {
     return TRIANGLE;
 }
@@ -387,8 +402,92 @@ std::string Triangle::toString() {
     return "Triangle(" + this->p1->toString() + ", " + this->p2->toString() + ", " + this->p3->toString() + ")";
 }
 
-void Triangle::progress(double t) {
+double Triangle::hitTime(Particle3D* p) {
+    Vec3 c = p->getCenter()->vec(), v = p->getVelocity()->vec() - velocity, d = c - p1->vec();
+    double r = p->getRadius(), best = NOT_COLLIDING,
+        s = dot(d, normal), vn = dot(v, normal);
 
+    if ((side != 0 && side * vn < 0) || (side == 0 && s * vn < 0)) {
+        double t = (fabs(s) - r) / fabs(vn);
+        if (t < 0 || side * s < 0) t = 0;
+        Vec3 w = d + v * t - normal * (s + vn * t);
+        double d20 = dot(w, e1), d21 = dot(w, e2),
+            bv = (d11 * d20 - d01 * d21) / den, bw = (d00 * d21 - d01 * d20) / den;
+        if (bv >= 0 && bw >= 0 && bv + bw <= 1) best = t;
+    }
+
+    Vec3 corners[3] = { p1->vec(), p2->vec(), p3->vec() };
+    double vv = dot(v, v);
+    for (int l = 0; l < 3; l++) {
+        // edge as a cylinder of radius r, using components perpendicular to it
+        Vec3 u = edge[l], de = c - corners[l];
+        double da = dot(de, u), va = dot(v, u);
+        Vec3 dp = de - u * da, vp = v - u * va;
+        double t = approachTime(dot(vp, vp), dot(dp, vp), dot(dp, dp), norm2(cross(dp, vp)), r * r);
+        if (t >= 0 && (best < 0 || t < best) && da + va * t >= 0 && da + va * t <= edge_length[l]) best = t;
+
+        t = approachTime(vv, dot(de, v), dot(de, de), norm2(cross(de, v)), r * r);
+        if (t >= 0 && (best < 0 || t < best)) best = t;
+    }
+    return best;
+}
+
+Point3D Triangle::closestPoint(Point3D* c) {
+    Vec3 d = c->vec() - p1->vec();
+    double s = dot(d, normal);
+    Vec3 w = d - normal * s;
+    double d20 = dot(w, e1), d21 = dot(w, e2),
+        bv = (d11 * d20 - d01 * d21) / den, bw = (d00 * d21 - d01 * d20) / den;
+    if (bv >= 0 && bw >= 0 && bv + bw <= 1) {
+        Vec3 q = c->vec() - normal * s;
+        return Point3D(q.x, q.y, q.z);
+    }
+
+    Vec3 corners[3] = { p1->vec(), p2->vec(), p3->vec() }, best = corners[0];
+    double best_d = -1;
+    for (int l = 0; l < 3; l++) {
+        double a = dot(c->vec() - corners[l], edge[l]);
+        a = a < 0 ? 0 : a > edge_length[l] ? edge_length[l] : a;
+        Vec3 q = corners[l] + edge[l] * a;
+        double dist = norm2(q - c->vec());
+        if (best_d < 0 || dist < best_d) {
+            best_d = dist;
+            best = q;
+        }
+    }
+    return Point3D(best.x, best.y, best.z);
+}
+
+double Triangle::reflect(Particle3D* p) {
+    Vec3 c = p->getCenter()->vec(), v = p->getVelocity()->vec() - velocity, n = normal;
+    Point3D q = closestPoint(p->getCenter());
+    double s = dot(c - p1->vec(), normal), nn = 1, scale = 1;
+
+    // as for Line2D, the face normal is exact; edges and corners use the closest point
+    Vec3 proj = c - normal * s;
+    if (side != 0) n *= side;
+    else if (s < 0 || (s == 0 && dot(n, v) > 0)) n = -n;
+    if (norm2(q.vec() - proj) > 0) {
+        Vec3 nq = c - q.vec();
+        double qq = dot(nq, nq);
+        if (qq > 0 && (side == 0 || dot(nq, n) > 0)) {
+            n = nq;
+            nn = qq;
+            scale = sqrt(qq);
+        }
+    }
+
+    double vn = dot(v, n);
+    if (vn >= 0) return 0;
+    p->getVelocity()->set(v + velocity - n * (2 * vn / nn));
+    return -2 * p->getMass() * vn / scale;
+}
+
+void Triangle::progress(double t) {
+    if (velocity.x == 0 && velocity.y == 0 && velocity.z == 0) return;
+    p1->set(p1->vec() + velocity * t);
+    p2->set(p2->vec() + velocity * t);
+    p3->set(p3->vec() + velocity * t);
 }
 
 Triangle::~Triangle() {
@@ -397,10 +496,6 @@ Triangle::~Triangle() {
     delete p3;
 }
 
-Vector2D::Vector2D(double x, double y) {
-    set(x, y);
-}
-
 Vector2D::Vector2D(Point2D* p1, Point2D* p2) : Vector2D(p2->getX() - p1->getX(), p2->getY() - p1->getY()) {
 }
 
@@ -408,35 +503,10 @@ Vector2D::Vector2D(Point2D* p1, Point2D* p2, bool normalize) : Vector2D(p1, p2)
     if (normalize) this->multiply(1 / this->len());
 }
 
-Vector2D::Vector2D(Vector2D* v) : Vector2D(v->x, v->y) {
-}
-
-double Vector2D::getX() {
-    return this->x;
-}
-
-double Vector2D::getY() {
-    return this->y;
-}
-
-void Vector2D::set(double x, double y) {
-    this->x = x;
-    this->y = y;
-}
-
 double Vector2D::len() {
     return sqrt(SQR(this->x) + SQR(this->y));
 }
 
-void Vector2D::multiply(double m) {
-    this->x *= m;
-    this->y *= m;
-}
-
-double Vector2D::scalar(Vector2D* v) {
-    return this->x * v->x + this->y * v->y;
-}
-
 std::string Vector2D::toString() {
     std::ostringstream ssx, ssy;
     ssx << std::scientific << this->x;
@@ -459,10 +529,6 @@ Vector2D Vector2D::sub(Vector2D* from, Vector2D* what) {
     return Vector2D(from->x - what->x, from->y - what->y);
 }
 
-Vector3D::Vector3D(double x, double y, double z) {
-    set(x, y, z);
-}
-
 Vector3D::Vector3D(Point3D* p1, Point3D* p2) : Vector3D(p2->getX() - p1->getX(), p2->getY() - p1->getY(), p2->getZ() - p1->getZ()) {
 }
 
@@ -470,41 +536,10 @@ Vector3D::Vector3D(Point3D* p1, Point3D* p2, bool normalize) : Vector3D(p1, p2)
     if (normalize) this->multiply(1 / this->len());
 }
 
-Vector3D::Vector3D(Vector3D* v) : Vector3D(v->x, v->y, v->z) {
-}
-
-double Vector3D::getX() {
-    return this->x;
-}
-
-double Vector3D::getY() {
-    return this->y;
-}
-
-double Vector3D::getZ() {
-    return this->z;
-}
-
-void Vector3D::set(double x, double y, double z) {
-    this->x = x;
-    this->y = y;
-    this->z = z;
-}
-
 double Vector3D::len() {
     return sqrt(SQR(this->x) + SQR(this->y) + SQR(this->z));
 }
 
-void Vector3D::multiply(double m) {
-    this->x *= m;
-    this->y *= m;
-    this->z *= m;
-}
-
-double Vector3D::scalar(Vector3D* v) {
-    return this->x * v->x + this->y * v->y + this->z * v->z;
-}
-
 std::string Vector3D::toString() {
     std::ostringstream ssx, ssy, ssz;
     ssx << std::scientific << this->x;
@@ -556,9 +591,8 @@ double ParticleConfig::getMass() {
     return this->m;
 }
 
-Particle2D::Particle2D(int id, Point2D* c, double r, double m, double vx, double vy) : ParticleConfig(id, r, m) {
-    this->c = new Point2D(c);
-    this->v = new Vector2D(vx, vy);
+Particle2D::Particle2D(int id, Point2D* c, double r, double m, double vx, double vy) : ParticleConfig(id, r, m), c(c), v(vx, vy) {
+    this->index = 0;
 }
 
 Particle2D::Particle2D(ParticleConfig* pc, Point2D* c, double vx, double vy) : Particle2D::Particle2D(pc->getId(), c, pc->getRadius(), pc->getMass(), vx, vy) {
@@ -566,7 +600,7 @@ Particle2D::Particle2D(ParticleConfig* pc, Point2D* c, double vx, double vy) : P
 }
 
 Point2D* Particle2D::getCenter() {
-    return this->c;
+    return &this->c;
 }
 
 int Particle2D::getId() {
@@ -582,11 +616,29 @@ double Particle2D::getMass() {
 }
 
 Vector2D* Particle2D::getVelocity() {
-    return this->v;
+    return &this->v;
+}
+
+int Particle2D::getIndex() {
+    return this->index;
+}
+
+void Particle2D::setIndex(int index) {
+    this->index = index;
+}
+
+// copies the physical state; the event table stays with the slot
+void Particle2D::assign(Particle2D* p) {
+    this->c = p->c;
+    this->v = p->v;
+    this->id = p->id;
+    this->r = p->r;
+    this->m = p->m;
+    this->index = p->index;
 }
 
 void Particle2D::progress(double t) {
-    this->c->add(this->v->getX() * t, this->v->getY() * t);
+    this->c.add(this->v.getX() * t, this->v.getY() * t);
 }
 
 TYPE Particle2D::getType() {
@@ -596,17 +648,15 @@ TYPE Particle2D::getType() {
 std::string Particle2D::toString() {
     std::ostringstream ssr;
     ssr << std::scientific << this->r;
-    return "Particle2D(" + this->c->toString() + ", " + ssr.str() + ", " + this->v->toString() + ")";
+    return "Particle2D(" + this->c.toString() + ", " + ssr.str() + ", " + this->v.toString() + ")";
 }
 
 Particle2D::~Particle2D() {
-    delete c;
-    delete v;
+
 }
 
-Particle3D::Particle3D(int id, Point3D* c, double r, double m, double vx, double vy, double vz) : ParticleConfig::ParticleConfig(id, r, m) {
-    this->c = new Point3D(c);
-    this->v = new Vector3D(vx, vy, vz);
+Particle3D::Particle3D(int id, Point3D* c, double r, double m, double vx, double vy, double vz) : ParticleConfig::ParticleConfig(id, r, m), c(c), v(vx, vy, vz) {
+    this->index = 0;
 }
 
 Particle3D::Particle3D(ParticleConfig* pc, Point3D* c, double vx, double vy, double vz) : Particle3D::Particle3D(pc->getId(), c, pc->getRadius(), pc->getMass(), vx, vy, vz) {
@@ -614,7 +664,7 @@ Particle3D::Particle3D(ParticleConfig* pc, Point3D* c, double vx, double vy, dou
 }
 
 Point3D* Particle3D::getCenter() {
-    return this->c;
+    return &this->c;
 }
 
 int Particle3D::getId() {
@@ -630,11 +680,29 @@ double Particle3D::getMass() {
 }
 
 Vector3D* Particle3D::getVelocity() {
-    return this->v;
+    return &this->v;
+}
+
+int Particle3D::getIndex() {
+    return this->index;
+}
+
+void Particle3D::setIndex(int index) {
+    this->index = index;
+}
+
+// copies the physical state; the event table stays with the slot
+void Particle3D::assign(Particle3D* p) {
+    this->c = p->c;
+    this->v = p->v;
+    this->id = p->id;
+    this->r = p->r;
+    this->m = p->m;
+    this->index = p->index;
 }
 
 void Particle3D::progress(double t) {
-    this->c->add(this->v->getX() * t, this->v->getY() * t, this->v->getZ() * t);
+    this->c.add(this->v.getX() * t, this->v.getY() * t, this->v.getZ() * t);
 }
 
 TYPE Particle3D::getType() {
@@ -642,109 +710,1530 @@ TYPE Particle3D::getType() {
 }
 
 std::string Particle3D::toString() {
-    return "Particle3D(" + this->c->toString() + ", " + this->v->toString() + ")";
+    return "Particle3D(" + this->c.toString() + ", " + this->v.toString() + ")";
 }
 
 Particle3D::~Particle3D() {
-    delete c;
-    delete v;
-}
 
-void Simulation::simulate() {
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::uniform_real_distribution<> distR(0, 1);
-    double t = 0, avg_pv = 0, temp, dp = 0, dt = 0;
+}
 
-    Event** events_1, ** events_2;
-    all_events_p = new Event * [(objs_len * (objs_len - 1)) / 2];
-    int b = 0;
-    for (int l = 0; l < objs_len; l++) objs[l]->initEvents(objs_len - 1);
-    for (int l = 0; l < objs_len; l++) {
-        events_1 = objs[l]->getEvents();
-        for (int j = l + 1; j < objs_len; j++) {
-            events_2 = objs[j]->getEvents();
-            all_events_p[b++] = events_1[j - 1] = new Event(objs[l], objs[j], t, PhObject::collision(objs[l], objs[j], -1));
-            if (events_1[j - 1]->dt <= -0.5) events_1[j - 1]->dt -= distR(rng);
-            events_2[l] = events_1[j - 1];
+Container2D::Container2D(std::vector<Point2D>& vertices, std::vector<int>& indices) {
+    int n = (int)indices.size() / 2;
+    std::vector<double> blo(3 * n), bhi(3 * n);
+    area = 0;
+    perimeter = 0;
+    for (int k = 0; k < 2; k++) {
+        lo[k] = INFINITY;
+        hi[k] = -INFINITY;
+    }
+    for (int l = 0; l < n; l++) {
+        Point2D* a = &vertices[indices[2 * l]], * b = &vertices[indices[2 * l + 1]];
+        area += (a->getX() * b->getY() - b->getX() * a->getY()) / 2;
+    }
+    // walls are one-sided, with the inside taken from the orientation of the outline
+    int side = area > 0 ? 1 : -1;
+    for (int l = 0; l < n; l++) {
+        Point2D* a = &vertices[indices[2 * l]], * b = &vertices[indices[2 * l + 1]];
+        segments.push_back(new Line2D(a, b, side));
+        perimeter += Point2D::distance(a, b);
+        blo[3 * l] = std::min(a->getX(), b->getX());
+        bhi[3 * l] = std::max(a->getX(), b->getX());
+        blo[3 * l + 1] = std::min(a->getY(), b->getY());
+        bhi[3 * l + 1] = std::max(a->getY(), b->getY());
+        blo[3 * l + 2] = bhi[3 * l + 2] = 0;
+        for (int k = 0; k < 2; k++) {
+            lo[k] = std::min(lo[k], blo[3 * l + k]);
+            hi[k] = std::max(hi[k], bhi[3 * l + k]);
+        }
+    }
+    area = fabs(area);
+    bvh = new BVH(blo.data(), bhi.data(), n);
+}
+
+// "v x y" vertices and "l i j ..." polylines with 1-based indices, as in Wavefront OBJ;
+// the outline has to be closed and consistently oriented
+Container2D* Container2D::load(std::string path) {
+    std::ifstream in(path);
+    if (!in.is_open()) return nullptr;
+    std::vector<Point2D> vertices;
+    std::vector<int> indices;
+    std::string line, tag;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        if (!(ss >> tag)) continue;
+        if (tag == "v") {
+            double x, y;
+            ss >> x >> y;
+            vertices.push_back(Point2D(x, y));
+        }
+        else if (tag == "l") {
+            int first, next;
+            if (!(ss >> first)) continue;
+            while (ss >> next) {
+                indices.push_back(first - 1);
+                indices.push_back(next - 1);
+                first = next;
+            }
         }
     }
-    std::multiset<Event*, decltype(Event::compare)*> allEvs(all_events_p, all_events_p + (objs_len * (objs_len - 1)) / 2, Event::compare);
+    for (int idx : indices) if (idx < 0 || idx >= (int)vertices.size()) return nullptr;
+    if (indices.empty()) return nullptr;
+    return new Container2D(vertices, indices);
+}
 
-    if (listener != nullptr) listener->OnSimulationStart(objs, objs_len);
-    Event* tEv, *pEv = nullptr;
-    for (int b = 0; b < sim_count * sim_step; b++) {
-
-        auto tEvit = allEvs.begin();
-        tEv = (*allEvs.begin());
-        while (pEv != nullptr && tEv == pEv && (tEv->t - t) + tEv->dt <= 0) { // hack da izbegnemo problem sa zaglavljenim kuglicama
-            //std::cout << tEv->dt << std::endl;;
-            allEvs.erase(tEvit);
-            tEv->dt = NOT_COLLIDING - distR(rng);
-            allEvs.insert(tEv);
-            tEvit = allEvs.begin();
-            tEv = (*allEvs.begin());
-        }
-        pEv = tEv;
-
-        for (int l = 0; l < objs_len; l++) objs[l]->progress((tEv->t - t) + tEv->dt);
-
-        temp = PhObject::collision(tEv->o1, tEv->o2, tEv->dt);
-        dp += temp;
-        dt += (tEv->t - t) + tEv->dt;
-        t = tEv->t + tEv->dt;
-
-        if (tEv->o1->getType() != LINE_2D && tEv->o1->getType() != TRIANGLE) {
-
-            events_1 = tEv->o1->getEvents();
-            for (int l = 0; l < objs_len - 1; l++) {
-                auto itt = allEvs.find(events_1[l]);
-                if (itt != allEvs.end()) {
-                    while (*itt != events_1[l])	++itt;
-
-                    allEvs.erase(itt);
-                    events_1[l]->t = t;
-                    events_1[l]->dt = PhObject::collision(events_1[l]->o1, events_1[l]->o2, -1);
-                    if (events_1[l]->dt <= -0.5) events_1[l]->dt -= distR(rng);
-                    allEvs.insert(events_1[l]);
-                }
+int Container2D::getSegmentCount() {
+    return (int)segments.size();
+}
+
+Line2D* Container2D::getSegment(int l) {
+    return segments[l];
+}
+
+double Container2D::getArea() {
+    return area;
+}
+
+double Container2D::getPerimeter() {
+    return perimeter;
+}
+
+double Container2D::getMin(int axis) {
+    return lo[axis];
+}
+
+double Container2D::getMax(int axis) {
+    return hi[axis];
+}
+
+bool Container2D::contains(Point2D* c, double clearance) {
+    // parity of crossings along a slightly tilted ray, so lattice points never hit a vertex exactly
+    double o[3] = { c->getX(), c->getY(), 0 }, d[2] = { 1, 0.0137 },
+        len = hi[0] - c->getX() + 1,
+        qlo[3] = { c->getX(), std::min(c->getY(), c->getY() + d[1] * len), 0 },
+        qhi[3] = { c->getX() + len, std::max(c->getY(), c->getY() + d[1] * len), 0 };
+    if (len <= 0) return false;
+    int crossings = 0;
+    bvh->overlap(qlo, qhi, [&](int i) {
+        Point2D* a = segments[i]->getFirstPoint(), * b = segments[i]->getSecondPoint();
+        double ex = b->getX() - a->getX(), ey = b->getY() - a->getY(),
+            den = d[0] * ey - d[1] * ex;
+        if (den == 0) return;
+        double wx = a->getX() - o[0], wy = a->getY() - o[1],
+            t = (wx * ey - wy * ex) / den, u = (wx * d[1] - wy * d[0]) / den;
+        if (t > 0 && u >= 0 && u < 1) crossings++;
+    });
+    if (crossings % 2 == 0) return false;
+
+    int i = bvh->nearest(o, [&](int i) {
+        Point2D q = segments[i]->closestPoint(c);
+        return Point2D::distance(&q, c);
+    });
+    Point2D q = segments[i]->closestPoint(c);
+    return Point2D::distance(&q, c) >= clearance;
+}
+
+double Container2D::hitTime(Particle2D* p) {
+    double o[3] = { p->getCenter()->getX(), p->getCenter()->getY(), 0 },
+        d[3] = { p->getVelocity()->getX(), p->getVelocity()->getY(), 0 };
+    return bvh->firstHit(o, d, p->getRadius(), [&](int i) { return segments[i]->hitTime(p); });
+}
+
+double Container2D::reflect(Particle2D* p) {
+    Point2D* c = p->getCenter();
+    double r = p->getRadius(), o[3] = { c->getX(), c->getY(), 0 };
+    int i = bvh->nearest(o, [&](int i) {
+        Point2D q = segments[i]->closestPoint(c);
+        return Point2D::distance(&q, c);
+    });
+    Point2D q = segments[i]->closestPoint(c);
+    double dp = segments[i]->reflect(p),
+        band = Point2D::distance(&q, c) + r * 1e-3,
+        qlo[3] = { o[0] - band, o[1] - band, 0 }, qhi[3] = { o[0] + band, o[1] + band, 0 };
+
+    // at a corner every segment in contact reflects, otherwise the second one is missed
+    bvh->overlap(qlo, qhi, [&](int j) {
+        if (j == i) return;
+        Point2D qj = segments[j]->closestPoint(c);
+        if (Point2D::distance(&qj, c) <= band) dp += segments[j]->reflect(p);
+    });
+    return dp;
+}
+
+TYPE Container2D::getType() {
+    return CONTAINER_2D;
+}
+
+void Container2D::progress(double t) {
+
+}
+
+std::string Container2D::toString() {
+    std::ostringstream ssa;
+    ssa << std::scientific << this->area;
+    return "Container2D(" + std::to_string(segments.size()) + ", " + ssa.str() + ")";
+}
+
+Container2D::~Container2D() {
+    for (Line2D* segment : segments) delete segment;
+    delete bvh;
+}
+
+Container3D::Container3D(std::vector<Point3D>& vertices, std::vector<int>& indices) {
+    int n = (int)indices.size() / 3;
+    std::vector<double> blo(3 * n), bhi(3 * n);
+    volume = 0;
+    surface = 0;
+    for (int k = 0; k < 3; k++) {
+        lo[k] = INFINITY;
+        hi[k] = -INFINITY;
+    }
+    for (int l = 0; l < n; l++) {
+        Point3D* a = &vertices[indices[3 * l]], * b = &vertices[indices[3 * l + 1]], * c = &vertices[indices[3 * l + 2]];
+        Vector3D va(a->getX(), a->getY(), a->getZ()), vb(b->getX(), b->getY(), b->getZ()), vc(c->getX(), c->getY(), c->getZ()),
+            cross = Vector3D::vector(&vb, &vc, false);
+        volume += va.scalar(&cross) / 6;
+    }
+    // positive volume means outward facing normals, so the inside is against them
+    int side = volume > 0 ? -1 : 1;
+    for (int l = 0; l < n; l++) {
+        Point3D* a = &vertices[indices[3 * l]], * b = &vertices[indices[3 * l + 1]], * c = &vertices[indices[3 * l + 2]];
+        facets.push_back(new Triangle(a, b, c, side));
+        Vector3D ab(a, b), ac(a, c), area = Vector3D::vector(&ab, &ac, false);
+        surface += area.len() / 2;
+        double x[3] = { a->getX(), b->getX(), c->getX() }, y[3] = { a->getY(), b->getY(), c->getY() }, z[3] = { a->getZ(), b->getZ(), c->getZ() };
+        blo[3 * l] = *std::min_element(x, x + 3);
+        bhi[3 * l] = *std::max_element(x, x + 3);
+        blo[3 * l + 1] = *std::min_element(y, y + 3);
+        bhi[3 * l + 1] = *std::max_element(y, y + 3);
+        blo[3 * l + 2] = *std::min_element(z, z + 3);
+        bhi[3 * l + 2] = *std::max_element(z, z + 3);
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], blo[3 * l + k]);
+            hi[k] = std::max(hi[k], bhi[3 * l + k]);
+        }
+    }
+    volume = fabs(volume);
+    bvh = new BVH(blo.data(), bhi.data(), n);
+}
+
+// Wavefront OBJ subset: "v x y z" and "f a b c ..." (polygons are fan triangulated);
+// the mesh has to be closed and consistently oriented
+Container3D* Container3D::load(std::string path) {
+    std::ifstream in(path);
+    if (!in.is_open()) return nullptr;
+    std::vector<Point3D> vertices;
+    std::vector<int> indices;
+    std::string line, tag, token;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line);
+        if (!(ss >> tag)) continue;
+        if (tag == "v") {
+            double x, y, z;
+            ss >> x >> y >> z;
+            vertices.push_back(Point3D(x, y, z));
+        }
+        else if (tag == "f") {
+            std::vector<int> face;
+            while (ss >> token) face.push_back(atoi(token.c_str()) - 1);
+            for (int l = 1; l + 1 < (int)face.size(); l++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[l]);
+                indices.push_back(face[l + 1]);
             }
         }
+    }
+    for (int idx : indices) if (idx < 0 || idx >= (int)vertices.size()) return nullptr;
+    if (indices.empty()) return nullptr;
+    return new Container3D(vertices, indices);
+}
+
+int Container3D::getFacetCount() {
+    return (int)facets.size();
+}
 
-        if (tEv->o2->getType() != LINE_2D && tEv->o2->getType() != TRIANGLE) {
+Triangle* Container3D::getFacet(int l) {
+    return facets[l];
+}
 
-            events_1 = tEv->o2->getEvents();
-            for (int l = 0; l < objs_len - 1; l++) {
-                auto itt = allEvs.find(events_1[l]);
-                if (itt != allEvs.end()) {
-                    while (*itt != events_1[l])	++itt;
+double Container3D::getVolume() {
+    return volume;
+}
 
-                    allEvs.erase(itt);
-                    events_1[l]->t = t;
-                    events_1[l]->dt = PhObject::collision(events_1[l]->o1, events_1[l]->o2, -1);
-                    if (events_1[l]->dt <= -0.5) events_1[l]->dt -= distR(rng);
-                    allEvs.insert(events_1[l]);
-                }
+double Container3D::getSurface() {
+    return surface;
+}
+
+double Container3D::getMin(int axis) {
+    return lo[axis];
+}
+
+double Container3D::getMax(int axis) {
+    return hi[axis];
+}
+
+bool Container3D::contains(Point3D* c, double clearance) {
+    double o[3] = { c->getX(), c->getY(), c->getZ() }, d[3] = { 1, 0.0137, 0.0291 },
+        len = hi[0] - c->getX() + 1, qlo[3], qhi[3];
+    if (len <= 0) return false;
+    for (int k = 0; k < 3; k++) {
+        qlo[k] = std::min(o[k], o[k] + d[k] * len);
+        qhi[k] = std::max(o[k], o[k] + d[k] * len);
+    }
+    int crossings = 0;
+    Vector3D dir(d[0], d[1], d[2]);
+    bvh->overlap(qlo, qhi, [&](int i) {
+        // Moller-Trumbore
+        Vector3D e1(facets[i]->getFirstPoint(), facets[i]->getSecondPoint()),
+            e2(facets[i]->getFirstPoint(), facets[i]->getThirdPoint()),
+            w(facets[i]->getFirstPoint(), c),
+            pv = Vector3D::vector(&dir, &e2, false);
+        double det = e1.scalar(&pv);
+        if (det == 0) return;
+        Vector3D qv = Vector3D::vector(&w, &e1, false);
+        double u = w.scalar(&pv) / det, v = dir.scalar(&qv) / det, t = e2.scalar(&qv) / det;
+        if (t > 0 && u >= 0 && v >= 0 && u + v <= 1) crossings++;
+    });
+    if (crossings % 2 == 0) return false;
+
+    int i = bvh->nearest(o, [&](int i) {
+        Point3D q = facets[i]->closestPoint(c);
+        return Point3D::distance(&q, c);
+    });
+    Point3D q = facets[i]->closestPoint(c);
+    return Point3D::distance(&q, c) >= clearance;
+}
+
+double Container3D::hitTime(Particle3D* p) {
+    double o[3] = { p->getCenter()->getX(), p->getCenter()->getY(), p->getCenter()->getZ() },
+        d[3] = { p->getVelocity()->getX(), p->getVelocity()->getY(), p->getVelocity()->getZ() };
+    return bvh->firstHit(o, d, p->getRadius(), [&](int i) { return facets[i]->hitTime(p); });
+}
+
+double Container3D::reflect(Particle3D* p) {
+    Point3D* c = p->getCenter();
+    double r = p->getRadius(), o[3] = { c->getX(), c->getY(), c->getZ() };
+    int i = bvh->nearest(o, [&](int i) {
+        Point3D q = facets[i]->closestPoint(c);
+        return Point3D::distance(&q, c);
+    });
+    Point3D q = facets[i]->closestPoint(c);
+    double dp = facets[i]->reflect(p),
+        band = Point3D::distance(&q, c) + r * 1e-3,
+        qlo[3] = { o[0] - band, o[1] - band, o[2] - band }, qhi[3] = { o[0] + band, o[1] + band, o[2] + band };
+
+    bvh->overlap(qlo, qhi, [&](int j) {
+        if (j == i) return;
+        Point3D qj = facets[j]->closestPoint(c);
+        if (Point3D::distance(&qj, c) <= band) dp += facets[j]->reflect(p);
+    });
+    return dp;
+}
+
+TYPE Container3D::getType() {
+    return CONTAINER_3D;
+}
+
+void Container3D::progress(double t) {
+
+}
+
+std::string Container3D::toString() {
+    std::ostringstream ssv;
+    ssv << std::scientific << this->volume;
+    return "Container3D(" + std::to_string(facets.size()) + ", " + ssv.str() + ")";
+}
+
+Container3D::~Container3D() {
+    for (Triangle* facet : facets) delete facet;
+    delete bvh;
+}
+
+// predicts every pair and builds the queue; the state is then advanced by run, step or advanceTo
+bool Simulation::initialize() {
+    if (queue != nullptr || flight != nullptr) return true;
+    if (objs_len == 0 && !build()) return false;
+    random.setSeed(seed);
+    sim_time = 0;
+    window_dp = 0;
+    window_dt = 0;
+    next_check = 2 * MIN_PRODUCTION_STEPS;
+    last = nullptr;
+    wall_dp.assign(walls_len, 0);
+    wall_hits.assign(walls_len, 0);
+    next_snapshot = 0;
+    samples = 0;
+    if (pv_estimators) startEstimators();
+    if ((correlation_interval > 0 || structure_interval > 0 || field_resolution > 0) && objs_len > walls_len) {
+        // species 0 is pc1, 1 is pc2, by creation index
+        int n = objs_len - walls_len, dim = objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+        std::vector<int> species(n);
+        for (int l = walls_len; l < objs_len; l++) {
+            if (dim == 3) species[static_cast<Particle3D*>(objs[l])->getIndex()] = static_cast<Particle3D*>(objs[l])->getId() == pc1->getId() ? 0 : 1;
+            else species[static_cast<Particle2D*>(objs[l])->getIndex()] = static_cast<Particle2D*>(objs[l])->getId() == pc1->getId() ? 0 : 1;
+        }
+        if (correlation_interval > 0) {
+            msd = new MultiTauCorrelator(DISPLACEMENT_CORRELATION, dim, species, 2, correlation_interval);
+            vacf = new MultiTauCorrelator(PRODUCT_CORRELATION, dim, species, 2, correlation_interval);
+            next_sample = 0;
+        }
+        double lo[3] = { -hfw, -hfw, -hfw }, hi[3] = { hfw, hfw, hfw },
+            volume = dim == 3 ? 8 * hfw * hfw * hfw : 4 * hfw * hfw;
+        if (objs[0]->getType() == CONTAINER_2D || objs[0]->getType() == CONTAINER_3D) {
+            for (int k = 0; k < dim; k++) {
+                lo[k] = dim == 3 ? static_cast<Container3D*>(objs[0])->getMin(k) : static_cast<Container2D*>(objs[0])->getMin(k);
+                hi[k] = dim == 3 ? static_cast<Container3D*>(objs[0])->getMax(k) : static_cast<Container2D*>(objs[0])->getMax(k);
             }
+            volume = dim == 3 ? static_cast<Container3D*>(objs[0])->getVolume() : static_cast<Container2D*>(objs[0])->getArea();
+        }
+        if (structure_interval > 0) {
+            structure = new StructureSampler(dim, species, 2, volume, lo, hi, structure_cutoff, structure_bins, structure_k, threads);
+            next_structure = 0;
+        }
+        if (field_resolution > 0) {
+            std::vector<double> mass = { pc1->getMass(), pc2->getMass() };
+            fields = new FieldGrid(dim, species, mass, lo, hi, field_resolution, kB);
+        }
+    }
+
+    if (free_flight && startFlight()) {
+        startMonitor();
+        if (listener != nullptr) listener->OnSimulationStart(objs, objs_len);
+        return true;
+    }
+
+    auto clock_start = std::chrono::steady_clock::now();
+    long long pairs = (long long)objs_len * (objs_len - 1) / 2;
+    predictAll(sim_time);
+    auto clock_predicted = std::chrono::steady_clock::now();
+
+    std::vector<Event*> all_events(pairs);
+    for (long long l = 0; l < pairs; l++) all_events[l] = events_pool + l;
+    if (queue_type == MULTISET_QUEUE) queue = new MultisetEventQueue();
+    else queue = new HeapEventQueue();
+    queue->build(all_events.data(), pairs);
+    std::vector<Event*>().swap(all_events);
+    auto clock_built = std::chrono::steady_clock::now();
+    stats.prediction = std::chrono::duration<double>(clock_predicted - clock_start).count();
+    stats.queue_build = std::chrono::duration<double>(clock_built - clock_predicted).count();
+    stats.startup = std::chrono::duration<double>(clock_built - clock_start).count();
+    stats.run += stats.startup;
+
+    if (!log_path.empty() && piston_speed != 0) std::cerr << "Cannot log events of a run with a piston, the replay keeps the walls fixed" << std::endl;
+    else if (!log_path.empty()) {
+        log = new EventLog(log_path);
+        if (log->isOpen()) log->writeHeader(objs, objs_len, walls_len, seed, getConfigString());
+        else {
+            std::cerr << "Cannot write event log " << log_path << std::endl;
+            delete log;
+            log = nullptr;
+        }
+    }
+
+    if (piston_speed != 0) {
+        if (findPiston()) {
+            piston_moving = piston_hold == 0;
+            piston_window = 0;
+            if (piston_moving) setPistonVelocity(piston_speed);
+        }
+        else std::cerr << "Cannot find the piston face, it needs the built-in box" << std::endl;
+    }
+
+    startMonitor();
+    if (listener != nullptr) listener->OnSimulationStart(objs, objs_len);
+    return true;
+}
+
+// handles the next event; true when it closed a window of sim_step events
+bool Simulation::processEvent() {
+    if (objs_len < 2) return false;
+    Event** events_1;
+    Event* tEv = queue->top();
+    while (last != nullptr && tEv == last && (tEv->t - sim_time) + tEv->dt <= 0) { // hack da izbegnemo problem sa zaglavljenim kuglicama
+        //std::cout << tEv->dt << std::endl;;
+        queue->update(tEv, tEv->t, NOT_COLLIDING - jitter(tEv));
+        tEv = queue->top();
+    }
+    last = tEv;
+
+    // positions follow the stored (rounded) event times exactly; otherwise the rounding
+    // of t accumulates into the positions and particles drift through the walls
+    double t_next = tEv->t + tEv->dt;
+    for (; sample_interval > 0 && next_snapshot <= t_next; next_snapshot += sample_interval) sampleAt(next_snapshot);
+    for (; msd != nullptr && next_sample <= t_next; next_sample += correlation_interval) sample(next_sample);
+    for (; structure != nullptr && next_structure <= t_next; next_structure += structure_interval) sampleStructure(next_structure);
+    for (int l = 0; l < objs_len; l++) objs[l]->progress(t_next - sim_time);
+
+    if (log != nullptr) log->writeEvent(externalId(tEv->o1), externalId(tEv->o2), t_next - sim_time);
+    if (fields != nullptr) {
+        // the velocities are about to change
+        if (PhObject::isParticle(tEv->o1)) flushField(tEv->o1, t_next);
+        if (PhObject::isParticle(tEv->o2)) flushField(tEv->o2, t_next);
+    }
+    double before[3], c[3];
+    if (pv_estimators) {
+        window_kinetic += kinetic * (t_next - sim_time);
+        particleState(PhObject::isParticle(tEv->o1) ? tEv->o1 : tEv->o2, c, before);
+    }
+    double dp = kernel(tEv->o1, tEv->o2, tEv->dt);
+    if (pv_estimators) collectVirial(tEv->o1, tEv->o2, before, dp);
+    window_dp += dp;
+    int wall = !PhObject::isParticle(tEv->o1) ? externalId(tEv->o1) : (!PhObject::isParticle(tEv->o2) ? externalId(tEv->o2) : -1);
+    if (wall >= 0) {
+        wall_dp[wall] += dp;
+        wall_hits[wall]++;
+    }
+    window_dt += t_next - sim_time;
+    sim_time = t_next;
+    stats.events++;
+
+    if (PhObject::isParticle(tEv->o1)) {
+
+        events_1 = tEv->o1->getEvents();
+        for (int l = 0; l < objs_len - 1; l++) {
+            double next = kernel(events_1[l]->o1, events_1[l]->o2, -1);
+            if (next <= -0.5) next -= jitter(events_1[l]);
+            queue->update(events_1[l], sim_time, next);
         }
+    }
+
+    if (PhObject::isParticle(tEv->o2)) {
+
+        events_1 = tEv->o2->getEvents();
+        for (int l = 0; l < objs_len - 1; l++) {
+            double next = kernel(events_1[l]->o1, events_1[l]->o2, -1);
+            if (next <= -0.5) next -= jitter(events_1[l]);
+            queue->update(events_1[l], sim_time, next);
+        }
+    }
+
+    if (reorder_interval > 0 && stats.events % reorder_interval == 0 && objs_len > walls_len) reorder(last);
+
+    if (stats.events % sim_step != 0) return false;
+    if (!piston_walls.empty()) {
+        // pV = p V = (dp / dt / S) V with the surface and volume at the end of the window
+        double W = pistonWidth(), H = 2 * hfw;
+        bool is3D = objs[0]->getType() == TRIANGLE;
+        double V = is3D ? W * H * H : W * H, S = is3D ? 2 * H * H + 4 * W * H : 2 * (W + H);
+        Vs = V / S;
+        volume_series.push_back(V);
+    }
+    pv_series.push_back(Vs * window_dp / window_dt);
+    if (pv_estimators) closeEstimators();
+    window_dp = 0;
+    window_dt = 0;
+    estimate_stale = true;
+    if (monitor != nullptr) publish(false);
+    if (fields != nullptr) {
+        for (int l = walls_len; l < objs_len; l++) flushField(objs[l], sim_time);
+        if (listener != nullptr) listener->OnSimulationFields(fields, sim_time, (int)pv_series.size() - 1);
+        fields->reset(sim_time);
+    }
+    if (!piston_walls.empty()) advancePiston();
+    return true;
+}
 
-        if ((b + 1) % sim_step == 0) {
-            avg_pv += Vs * dp / dt;
-            if (listener != nullptr) listener->OnSimulationStep(Vs * dp / dt, N * kB * T, (b + 1) / sim_step - 1);
-            dp = 0;
-            dt = 0;
+// particles pass through each other and only the walls are seen, so no pair events are
+// predicted or kept; needs the built-in box with fixed walls
+bool Simulation::startFlight() {
+    if (!container_path.empty() || piston_speed != 0) {
+        std::cerr << "Cannot use free flight with a container or a piston, running event driven" << std::endl;
+        return false;
+    }
+    if (!log_path.empty()) std::cerr << "Cannot log events of a free flight, there are none" << std::endl;
+    if (fields != nullptr) {
+        std::cerr << "Cannot keep fields in a free flight, the paths fold at the walls" << std::endl;
+        delete fields;
+        fields = nullptr;
+    }
+    if (pv_estimators) {
+        std::cerr << "Cannot estimate pV from collisions in a free flight, there are none" << std::endl;
+        pv_estimators = false;
+    }
+    auto clock_start = std::chrono::steady_clock::now();
+    int n = objs_len - walls_len;
+    std::vector<double> radius(n), mass(n);
+    int dim = snapshot(sample_c, sample_v);
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            radius[p->getIndex()] = p->getRadius();
+            mass[p->getIndex()] = p->getMass();
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            radius[p->getIndex()] = p->getRadius();
+            mass[p->getIndex()] = p->getMass();
+        }
+    }
+    flight = new FreeFlight(dim, sample_c, sample_v, radius, mass, hfw, threads);
+    double rate = flight->getHitRate();
+    // a window is as long as sim_step wall hits take on average
+    flight_window = rate > 0 ? sim_step / rate : 0;
+    stats.threads = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+    stats.startup = std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+    stats.run += stats.startup;
+    return true;
+}
+
+// closed form flight to t: samples on the way, the wall impulse and the hit count
+void Simulation::flyTo(double t) {
+    for (; sample_interval > 0 && next_snapshot <= t; next_snapshot += sample_interval) sampleAt(next_snapshot);
+    for (; msd != nullptr && next_sample <= t; next_sample += correlation_interval) sample(next_sample);
+    for (; structure != nullptr && next_structure <= t; next_structure += structure_interval) sampleStructure(next_structure);
+    long long hits;
+    window_dp += flight->impulse(sim_time, t, hits);
+    window_dt += t - sim_time;
+    stats.events += hits;
+    sim_time = t;
+}
+
+// the rest of the current window; false when nothing moves
+bool Simulation::flightWindow() {
+    if (flight_window <= 0) return false;
+    flyTo(sim_time + (flight_window - window_dt));
+    pv_series.push_back(Vs * window_dp / window_dt);
+    window_dp = 0;
+    window_dt = 0;
+    estimate_stale = true;
+    if (monitor != nullptr) publish(false);
+    return true;
+}
+
+// the particle objects are only brought up to date for listeners, snapshots and the end
+void Simulation::syncFlight() {
+    snapshot(sample_c, sample_v);
+    flight->stateAt(sim_time, sample_c.data(), sample_v.data());
+    setState(sample_c, sample_v);
+}
+
+// inverse of snapshot
+void Simulation::setState(const std::vector<double>& positions, const std::vector<double>& velocities) {
+    int dim = objs_len > walls_len && objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            const double* c = &positions[3 * p->getIndex()], * v = &velocities[3 * p->getIndex()];
+            p->getCenter()->set(c[0], c[1], c[2]);
+            p->getVelocity()->set(v[0], v[1], v[2]);
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            const double* c = &positions[2 * p->getIndex()], * v = &velocities[2 * p->getIndex()];
+            p->getCenter()->set(c[0], c[1]);
+            p->getVelocity()->set(v[0], v[1]);
+        }
+    }
+}
+
+void Simulation::startMonitor() {
+    if (monitor_name.empty() || monitor != nullptr) return;
+    monitor = Monitor::create(monitor_name);
+    if (!monitor->isOpen()) {
+        std::cerr << "Cannot create monitor " << monitor_name << std::endl;
+        delete monitor;
+        monitor = nullptr;
+        return;
+    }
+    monitor_state = new MonitorState();
+    std::string config = getConfigString();
+    config.copy(monitor_state->config, sizeof(monitor_state->config) - 1);
+    monitor_start = monitor_last = std::chrono::steady_clock::now();
+    monitor_events = stats.events;
+    publish(false);
+}
+
+// a few stores per window; the rate is taken over at least a second of wall time
+void Simulation::publish(bool finished) {
+    MonitorState& s = *monitor_state;
+    auto now = std::chrono::steady_clock::now();
+    double since = std::chrono::duration<double>(now - monitor_last).count();
+    if (since >= 1 || (finished && since > 0)) {
+        s.events_per_second = (stats.events - monitor_events) / since;
+        monitor_last = now;
+        monitor_events = stats.events;
+    }
+    s.sim_time = sim_time;
+    s.wall_time = std::chrono::duration<double>(now - monitor_start).count();
+    s.events = stats.events;
+    s.queue_size = flight != nullptr ? 0 : (long long)objs_len * (objs_len - 1) / 2;
+    s.windows = (long long)pv_series.size();
+    if (s.windows > 0) s.pv[(s.windows - 1) % MONITOR_HISTORY] = pv_series.back();
+    s.reorders = stats.reorders;
+    s.NkBT = (objs_len - walls_len) * kB * T;
+    s.startup = stats.startup;
+    s.prediction = stats.prediction;
+    s.queue_build = stats.queue_build;
+    s.reorder = stats.reorder;
+    s.threads = stats.threads;
+    s.finished = finished ? 1 : 0;
+    monitor->publish(s);
+}
+
+void Simulation::flushField(PhObject* o, double t) {
+    if (o->getType() == PARTICLE_3D) {
+        Particle3D* p = static_cast<Particle3D*>(o);
+        double c[3] = { p->getCenter()->getX(), p->getCenter()->getY(), p->getCenter()->getZ() },
+            v[3] = { p->getVelocity()->getX(), p->getVelocity()->getY(), p->getVelocity()->getZ() };
+        fields->flush(p->getIndex(), c, v, t);
+    }
+    else {
+        Particle2D* p = static_cast<Particle2D*>(o);
+        double c[2] = { p->getCenter()->getX(), p->getCenter()->getY() }, v[2] = { p->getVelocity()->getX(), p->getVelocity()->getY() };
+        fields->flush(p->getIndex(), c, v, t);
+    }
+}
+
+// the face of the box at x = +hfw, as one segment or two triangles
+bool Simulation::findPiston() {
+    piston_walls.clear();
+    for (int l = 0; l < walls_len; l++) {
+        if (objs[l]->getType() == LINE_2D) {
+            Line2D* w = static_cast<Line2D*>(objs[l]);
+            if (w->getFirstPoint()->getX() == hfw && w->getSecondPoint()->getX() == hfw) piston_walls.push_back(l);
+        }
+        else if (objs[l]->getType() == TRIANGLE) {
+            Triangle* w = static_cast<Triangle*>(objs[l]);
+            if (w->getFirstPoint()->getX() == hfw && w->getSecondPoint()->getX() == hfw && w->getThirdPoint()->getX() == hfw) piston_walls.push_back(l);
+        }
+    }
+    return !piston_walls.empty();
+}
+
+double Simulation::pistonWidth() {
+    PhObject* w = objs[piston_walls[0]];
+    double x = w->getType() == LINE_2D ? static_cast<Line2D*>(w)->getFirstPoint()->getX() : static_cast<Triangle*>(w)->getFirstPoint()->getX();
+    return x + hfw;
+}
+
+// the piston's pending events were predicted for the old velocity
+void Simulation::setPistonVelocity(double speed) {
+    for (int w : piston_walls) {
+        if (objs[w]->getType() == LINE_2D) static_cast<Line2D*>(objs[w])->setVelocity(speed, 0);
+        else static_cast<Triangle*>(objs[w])->setVelocity(speed, 0, 0);
+        Event** events_1 = objs[w]->getEvents();
+        for (int l = 0; l < objs_len - 1; l++) {
+            double next = kernel(events_1[l]->o1, events_1[l]->o2, -1);
+            if (next <= -0.5) next -= jitter(events_1[l]);
+            queue->update(events_1[l], sim_time, next);
+        }
+    }
+}
+
+// called at every window end: the piston alternates move_windows windows of motion with
+// hold_windows windows at rest, and stops for good once the box is min_width wide or back at
+// its original size. the work done on the gas is removed by the thermostat after every
+// stretch of motion
+void Simulation::advancePiston() {
+    double W = pistonWidth();
+    bool done = piston_speed < 0 ? W <= piston_min : W >= 2 * hfw;
+    piston_window++;
+    if (piston_moving && (done || piston_window >= piston_move)) {
+        piston_window = 0;
+        if (done || piston_hold > 0) {
+            piston_moving = false;
+            setPistonVelocity(0);
+        }
+        if (done) piston_speed = 0;
+        thermostat();
+    }
+    else if (!piston_moving && piston_speed != 0 && piston_window >= piston_hold) {
+        piston_moving = true;
+        piston_window = 0;
+        setPistonVelocity(piston_speed);
+    }
+}
+
+// rescales the velocities to the kinetic energy of temperature T and predicts everything anew
+void Simulation::thermostat() {
+    int n = objs_len - walls_len, dim = objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+    double energy = getKineticEnergy();
+    if (n == 0 || energy <= 0) return;
+    double factor = sqrt(dim * n * kB * T / 2 / energy);
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) static_cast<Particle3D*>(objs[l])->getVelocity()->multiply(factor);
+        else static_cast<Particle2D*>(objs[l])->getVelocity()->multiply(factor);
+    }
+    long long pairs = (long long)objs_len * (objs_len - 1) / 2;
+    std::vector<Event*> all_events(pairs);
+    for (long long l = 0; l < pairs; l++) {
+        Event* e = events_pool + l;
+        e->t = sim_time;
+        e->dt = kernel(e->o1, e->o2, -1);
+        if (e->dt <= -0.5) e->dt -= jitter(e);
+        all_events[l] = e;
+    }
+    queue->build(all_events.data(), pairs);
+}
+
+// initialises on the first call; every call then runs sim_count more windows, or fewer once
+// the adaptive tolerance is met
+void Simulation::run() {
+    if (!initialize()) return;
+    auto clock_start = std::chrono::steady_clock::now();
+    // a free flight closes a whole window per pass
+    for (long long b = 0; b < sim_count * sim_step; b += flight != nullptr ? sim_step : 1) {
+        bool converged = false;
+        if (flight != nullptr ? flightWindow() : processEvent()) {
+            int n = (int)pv_series.size();
+            if (listener != nullptr) listener->OnSimulationStep(pv_series.back(), N * kB * T, n - 1);
             //for (int l = walls_len; l < objs_len; l++) myfile << static_cast<Particle2D*>(objs[l])->getVelocity()->len() << endl;
+
+            // checks are spaced geometrically so MSER stays amortised O(1) per step
+            if (tolerance > 0 && n >= next_check) {
+                next_check = n + (n / 16 > MIN_PRODUCTION_STEPS ? n / 16 : MIN_PRODUCTION_STEPS);
+                updatePVEstimate();
+                // the combined estimate reaches the tolerance first, when there is one
+                converged = n - equilibration_step >= MIN_PRODUCTION_STEPS &&
+                    estimate_err[PV_COMBINED] < tolerance * fabs(estimate_mean[PV_COMBINED]);
+            }
         }
-        if (listener != nullptr) listener->OnSimulationIteration(objs, objs_len, b);
+        if (listener != nullptr && flight != nullptr) syncFlight();
+        if (listener != nullptr) listener->OnSimulationIteration(objs, objs_len, (int)(stats.events - 1));
+        if (converged) break;
     }
+    if (flight != nullptr) syncFlight();
+    stats.run += std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+    // a finished run can be replayed while the simulation object is kept for more steps
+    if (log != nullptr) log->flush();
+    updatePVEstimate();
+    if (objs_len > walls_len) storeSnapshot(objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2);
+    if (structure != nullptr) structure->finish();
+    if (listener != nullptr && msd != nullptr) listener->OnSimulationCorrelations(msd, vacf);
+    if (listener != nullptr && structure != nullptr) listener->OnSimulationStructure(structure);
+    if (monitor != nullptr) publish(true);
     if (listener != nullptr) listener->OnSimulationEnd(objs, objs_len);
+}
+
+// n more events without any listener calls; a free flight goes on for as long as n hits
+// take on average
+long long Simulation::step(long long n) {
+    if (!initialize() || objs_len < 2) return 0;
+    if (flight != nullptr) {
+        advanceTo(sim_time + flight_window * n / sim_step);
+        return n;
+    }
+    auto clock_start = std::chrono::steady_clock::now();
+    for (long long b = 0; b < n; b++) processEvent();
+    stats.run += std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+    return n;
+}
+
+// every event up to the given time, then free flight to it; returns the number of events
+long long Simulation::advanceTo(double time) {
+    if (!initialize() || time < sim_time) return 0;
+    auto clock_start = std::chrono::steady_clock::now();
+    long long n = 0;
+    if (flight != nullptr) {
+        n = stats.events;
+        while (flight_window > 0 && sim_time + (flight_window - window_dt) <= time) flightWindow();
+        flyTo(time);
+        syncFlight();
+        stats.run += std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+        return stats.events - n;
+    }
+    while (objs_len >= 2) {
+        Event* next = queue->top();
+        if (next->dt <= -0.5 || next->t + next->dt > time) break;
+        processEvent();
+        n++;
+    }
+    // the flight after the last event is logged as a record of its own, or the replay would
+    // measure the next step from the wrong time
+    if (log != nullptr && time > sim_time) log->writeEvent(0, 0, time - sim_time);
+    for (int l = 0; l < objs_len; l++) objs[l]->progress(time - sim_time);
+    if (pv_estimators) window_kinetic += kinetic * (time - sim_time);
+    window_dt += time - sim_time;
+    sim_time = time;
+    stats.run += std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+    return n;
+}
+
+double Simulation::getTime() {
+    return sim_time;
+}
+
+long long Simulation::getEventCount() {
+    return stats.events;
+}
+
+// positions and velocities ordered by particle index, dim values per particle; returns dim
+int Simulation::snapshot(std::vector<double>& positions, std::vector<double>& velocities) {
+    int n = objs_len - walls_len, dim = n > 0 && objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+    positions.resize((size_t)dim * n);
+    velocities.resize((size_t)dim * n);
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            double* c = &positions[3 * p->getIndex()], * v = &velocities[3 * p->getIndex()];
+            c[0] = p->getCenter()->getX();
+            c[1] = p->getCenter()->getY();
+            c[2] = p->getCenter()->getZ();
+            v[0] = p->getVelocity()->getX();
+            v[1] = p->getVelocity()->getY();
+            v[2] = p->getVelocity()->getZ();
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            double* c = &positions[2 * p->getIndex()], * v = &velocities[2 * p->getIndex()];
+            c[0] = p->getCenter()->getX();
+            c[1] = p->getCenter()->getY();
+            v[0] = p->getVelocity()->getX();
+            v[1] = p->getVelocity()->getY();
+        }
+    }
+    return dim;
+}
+
+// replaces the lattice with the nearest stored state scaled to this box; the velocities drawn
+// for the lattice are kept, so the run starts at the requested temperature
+// what a warm start looks for: the particle count, packing fraction and fraction of species 1
+// of the lattice build() fills, from the same species draws, so it is known before the build
+void Simulation::warmTarget(int dim, int& n, double& packing, double& mix) {
+    n = N - N_offset < N_real ? N - N_offset : N_real;
+    if (n < 0) n = 0;
+    CounterRNG draws(seed);
+    double filled = 0, first = 0;
+    for (int l = 0; l < n; l++) {
+        bool one = draws.uniform(STREAM_SPECIES, N_offset + l) <= rate;
+        double r = one ? pc1->getRadius() : pc2->getRadius();
+        filled += dim == 3 ? 4 * PI * r * r * r / 3 : PI * r * r;
+        if (one) first++;
+    }
+    packing = filled / (dim == 3 ? 8 * hfw * hfw * hfw : 4 * hfw * hfw);
+    mix = n > 0 ? first / n : 0;
+}
+
+bool Simulation::warmStart(int dim) {
+    int n = objs_len - walls_len, sites;
+    warmTarget(dim, sites, packing, mix);
+    if (snapshots == nullptr || !container_path.empty() || n == 0 || n != sites) return false;
+    std::vector<double> c((size_t)dim * n), r(n);
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) r[static_cast<Particle3D*>(objs[l])->getIndex()] = static_cast<Particle3D*>(objs[l])->getRadius();
+        else r[static_cast<Particle2D*>(objs[l])->getIndex()] = static_cast<Particle2D*>(objs[l])->getRadius();
+    }
+    if (!snapshots->load(dim, n, packing, mix, c)) return false;
+
+    // the stored state may come from a denser or differently mixed system, so it is only
+    // used if nothing overlaps after scaling; pairs and walls caught exactly at contact are fine
+    for (int l = 0; l < n; l++)
+        for (int k = 0; k < dim; k++) {
+            c[dim * l + k] *= hfw;
+            if (fabs(c[dim * l + k]) + r[l] > hfw * (1 + CONTACT_TOLERANCE)) return false;
+        }
+    for (int l = 0; l < n; l++)
+        for (int j = l + 1; j < n; j++) {
+            double d = 0;
+            for (int k = 0; k < dim; k++) d += COLL_A(c[dim * l + k], c[dim * j + k]);
+            if (d < (r[l] + r[j]) * (r[l] + r[j]) * (1 - CONTACT_TOLERANCE)) return false;
+        }
+    for (int l = walls_len; l < objs_len; l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            p->getCenter()->set(c[3 * p->getIndex()], c[3 * p->getIndex() + 1], c[3 * p->getIndex() + 2]);
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            p->getCenter()->set(c[2 * p->getIndex()], c[2 * p->getIndex() + 1]);
+        }
+    }
+    warm = true;
+    return true;
+}
+
+// the particles move freely until the next event, so the state at t is exact; the box has
+// no periodic images, so the positions need no unwrapping
+void Simulation::stateAt(double t) {
+    snapshot(sample_c, sample_v);
+    if (flight != nullptr) {
+        flight->stateAt(t, sample_c.data(), sample_v.data());
+        return;
+    }
+    double dt = t - sim_time;
+    for (size_t l = 0; l < sample_c.size(); l++) sample_c[l] += sample_v[l] * dt;
+}
+
+void Simulation::sample(double t) {
+    stateAt(t);
+    msd->add(sample_c.data());
+    vacf->add(sample_v.data());
+}
+
+// the particles are moved to t for the listener and then put back bit for bit, so a sampled run
+// follows the same trajectory as an unsampled one
+void Simulation::sampleAt(double t) {
+    if (listener == nullptr) return;
+    std::vector<double> c, v;
+    snapshot(c, v);
+    stateAt(t);
+    setState(sample_c, sample_v);
+    listener->OnSimulationSample(objs, objs_len, t, samples++);
+    setState(c, v);
+}
+
+// returns once the positions are copied; the counting runs on the sampler's pool
+void Simulation::sampleStructure(double t) {
+    stateAt(t);
+    structure->add(sample_c.data());
+}
+
+// only states well past the detected equilibration are worth starting from
+void Simulation::storeSnapshot(int dim) {
+    int n = objs_len - walls_len;
+    if (snapshots == nullptr || !container_path.empty() || (int)pv_series.size() - equilibration_step < MIN_PRODUCTION_STEPS) return;
+    // by index, as the slots may have been reordered since the build
+    std::vector<double> c, v;
+    snapshot(c, v);
+    for (double& x : c) x /= hfw;
+    snapshots->save(dim, n, packing, mix, c);
+}
+
+// tie breaking offset for a non-colliding event: keyed by the pair and the event count, so it
+// repeats only when the same pair is re-predicted within one event, where it does not matter
+double Simulation::jitter(Event* e) {
+    return random.uniform(STREAM_JITTER, e - events_pool, (uint32_t)stats.events);
+}
+
+// species and maxwell-boltzmann velocities of the lattice sites N_offset ..; both are keyed by
+// the site, so a site gets the same particle whatever the offset or the container drops
+void Simulation::sampleSites(int dim, std::vector<char>& first, std::vector<double>& v) {
+    int sites = N - N_offset < N_real ? N - N_offset : N_real;
+    if (sites < 0) sites = 0;
+    random.setSeed(seed);
+    first.resize(sites);
+    v.resize((size_t)sites * dim);
+    std::vector<double> sigma(sites);
+    double sigma_1 = sqrt(kB * T / pc1->getMass()), sigma_2 = sqrt(kB * T / pc2->getMass());
+    for (int l = 0; l < sites; l++) {
+        first[l] = random.uniform(STREAM_SPECIES, N_offset + l) <= rate;
+        sigma[l] = first[l] ? sigma_1 : sigma_2;
+    }
+    random.maxwell(STREAM_VELOCITY, N_offset, sites, dim, sigma.data(), v.data());
+}
+
+// rows of the pair triangle are split between threads by pair count; a thread writes only
+// its own slots of the pool and of the per-object event tables
+void Simulation::predictAll(double t) {
+    long long pairs = (long long)objs_len * (objs_len - 1) / 2;
+    events_pool = arena->allocate<Event>(pairs);
+    Event** tables = arena->allocate<Event*>((size_t)objs_len * (objs_len - 1));
+    for (int l = 0; l < objs_len; l++) objs[l]->initEvents(objs_len - 1, tables + (size_t)l * (objs_len - 1));
+    int n = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+    if (n < 1 || pairs < PARALLEL_MIN_PAIRS) n = 1;
+    std::vector<int> first(n + 1, objs_len);
+    first[0] = 0;
+    long long counted = 0;
+    for (int l = 0, k = 1; l < objs_len && k < n; l++) {
+        counted += objs_len - 1 - l;
+        if (counted >= pairs * k / n) first[k++] = l + 1;
+    }
 
-    //std::cout << avg_pv / sim_count << std::endl;
+    auto predict = [this, t](int from, int to) {
+        for (int l = from; l < to; l++) {
+            Event** events_1 = objs[l]->getEvents();
+            Event* e = events_pool + (long long)l * objs_len - (long long)l * (l + 1) / 2;
+            for (int j = l + 1; j < objs_len; j++, e++) {
+                new (e) Event(objs[l], objs[j], t, kernel(objs[l], objs[j], -1));
+                // the jitter is keyed by the pair, so it can be drawn on any thread
+                if (e->dt <= -0.5) e->dt -= jitter(e);
+                events_1[j - 1] = e;
+                objs[j]->getEvents()[l] = e;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int k = 1; k < n; k++) workers.push_back(std::thread(predict, first[k], first[k + 1]));
+    predict(first[0], first[1]);
+    for (std::thread& worker : workers) worker.join();
+    stats.threads = n;
+}
+
+// interleaves the bits of the cell coordinates
+static unsigned long long morton(const unsigned int* cell, int dim, int bits) {
+    unsigned long long code = 0;
+    for (int b = bits - 1; b >= 0; b--)
+        for (int k = 0; k < dim; k++) code = (code << 1) | ((cell[k] >> b) & 1);
+    return code;
+}
+
+// moves the states along the cycles of the permutation; slot k receives the state of slot from[k]
+template <class P> static void permute(PhObject** objs, const std::vector<int>& from, P* tmp) {
+    std::vector<bool> done(from.size(), false);
+    for (int s = 0; s < (int)from.size(); s++) {
+        if (done[s] || from[s] == s) continue;
+        tmp->assign(static_cast<P*>(objs[s]));
+        int k = s;
+        while (from[k] != s) {
+            static_cast<P*>(objs[k])->assign(static_cast<P*>(objs[from[k]]));
+            done[k] = true;
+            k = from[k];
+        }
+        static_cast<P*>(objs[k])->assign(tmp);
+        done[k] = true;
+    }
 }
 
+// sorts the particle slots along a Morton curve of their cells, so particles that are close in
+// space are close in memory; event keys move with the pair of particles and the queue is rebuilt
+void Simulation::reorder(Event*& last) {
+    auto clock_start = std::chrono::steady_clock::now();
+    int n = objs_len - walls_len, dim = objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2,
+        bits = dim == 3 ? MORTON_BITS_3D : MORTON_BITS_2D;
+    std::vector<double> c((size_t)dim * n);
+    double lo[3] = { INFINITY, INFINITY, INFINITY }, hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (int l = 0; l < n; l++) {
+        if (dim == 3) {
+            Point3D* p = static_cast<Particle3D*>(objs[walls_len + l])->getCenter();
+            c[3 * l] = p->getX();
+            c[3 * l + 1] = p->getY();
+            c[3 * l + 2] = p->getZ();
+        }
+        else {
+            Point2D* p = static_cast<Particle2D*>(objs[walls_len + l])->getCenter();
+            c[2 * l] = p->getX();
+            c[2 * l + 1] = p->getY();
+        }
+        for (int k = 0; k < dim; k++) {
+            lo[k] = std::min(lo[k], c[dim * l + k]);
+            hi[k] = std::max(hi[k], c[dim * l + k]);
+        }
+    }
+    std::vector<std::pair<unsigned long long, int>> order(n);
+    double cells = (double)((1u << bits) - 1);
+    for (int l = 0; l < n; l++) {
+        unsigned int cell[3] = { 0, 0, 0 };
+        for (int k = 0; k < dim; k++)
+            if (hi[k] > lo[k]) cell[k] = (unsigned int)((c[dim * l + k] - lo[k]) / (hi[k] - lo[k]) * cells);
+        order[l] = std::make_pair(morton(cell, dim, bits), l);
+    }
+    std::sort(order.begin(), order.end());
+
+    // slot k of the new order takes the particle from slot from[k]; pos is the inverse over all objects
+    std::vector<int> from(objs_len), pos(objs_len);
+    for (int l = 0; l < objs_len; l++) from[l] = l;
+    for (int l = 0; l < n; l++) from[walls_len + l] = walls_len + order[l].second;
+    for (int l = 0; l < objs_len; l++) pos[from[l]] = l;
+
+    long long pairs = (long long)objs_len * (objs_len - 1) / 2, e = 0;
+    std::vector<double> t(pairs), dt(pairs);
+    Event* moved = last;
+    for (int a = 0; a < objs_len; a++)
+        for (int b = a + 1; b < objs_len; b++, e++) {
+            int na = std::min(pos[a], pos[b]), nb = std::max(pos[a], pos[b]);
+            long long ne = (long long)na * objs_len - (long long)na * (na + 1) / 2 + (nb - na - 1);
+            t[ne] = events_pool[e].t;
+            dt[ne] = events_pool[e].dt;
+            if (events_pool + e == last) moved = events_pool + ne;
+        }
+    for (e = 0; e < pairs; e++) {
+        events_pool[e].t = t[e];
+        events_pool[e].dt = dt[e];
+    }
+    last = moved;
+
+    std::vector<int> slots(from.begin() + walls_len, from.end());
+    for (int l = 0; l < n; l++) slots[l] -= walls_len;
+    if (dim == 3) {
+        Point3D o(0, 0, 0);
+        Particle3D tmp(0, &o, 0, 0, 0, 0, 0);
+        permute(objs + walls_len, slots, &tmp);
+    }
+    else {
+        Point2D o(0, 0);
+        Particle2D tmp(0, &o, 0, 0, 0, 0);
+        permute(objs + walls_len, slots, &tmp);
+    }
+
+    std::vector<Event*> all_events(pairs);
+    for (e = 0; e < pairs; e++) all_events[e] = events_pool + e;
+    queue->build(all_events.data(), pairs);
+    stats.reorders++;
+    stats.reorder += std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+}
+
+void Simulation::updatePVEstimate() {
+    int n = (int)pv_series.size();
+    estimate_stale = false;
+    equilibration_step = Statistics::mser(pv_series.data(), n, MSER_BATCH);
+    pv_mean = Statistics::mean(pv_series.data() + equilibration_step, n - equilibration_step);
+    pv_err = Statistics::blockStdErr(pv_series.data() + equilibration_step, n - equilibration_step);
+    estimate_mean[PV_WALL] = estimate_mean[PV_COMBINED] = pv_mean;
+    estimate_err[PV_WALL] = estimate_err[PV_COMBINED] = pv_err;
+    pv_weights.assign(1, 1);
+    if (!pv_estimators || (int)estimator_series[PV_VIRIAL].size() != n) return;
+
+    // every estimator is truncated where the wall series is, they share the transient
+    int m = n - equilibration_step;
+    for (int k = PV_VIRIAL; k <= PV_KINETIC; k++) {
+        estimate_mean[k] = Statistics::mean(estimator_series[k].data() + equilibration_step, m);
+        estimate_err[k] = Statistics::blockStdErr(estimator_series[k].data() + equilibration_step, m);
+    }
+    // the wall series stays out of the mix: it averages dp / dt over windows, which runs high by
+    // about one over the wall hits per window, and the combination assumes unbiased members
+    const double* x[2] = { estimator_series[PV_VIRIAL].data() + equilibration_step, estimator_series[PV_CONTACT].data() + equilibration_step };
+    std::vector<double> weights;
+    std::vector<double>& combined = estimator_series[PV_COMBINED];
+    bool mixed = Statistics::combine(x, 2, m, weights, combined);
+    if (mixed) {
+        pv_weights = { 0, weights[0], weights[1] };
+        estimate_mean[PV_COMBINED] = Statistics::mean(combined.data(), m);
+        estimate_err[PV_COMBINED] = Statistics::blockStdErr(combined.data(), m);
+    }
+    // the weights come from a noisy covariance; the two are nearly collinear in a dilute gas,
+    // which can leave the mix worse than its better member
+    int best = estimate_err[PV_CONTACT] < estimate_err[PV_VIRIAL] ? PV_CONTACT : PV_VIRIAL;
+    if (!mixed || estimate_err[best] < estimate_err[PV_COMBINED]) {
+        pv_weights.assign(3, 0);
+        pv_weights[best] = 1;
+        estimate_mean[PV_COMBINED] = estimate_mean[best];
+        estimate_err[PV_COMBINED] = estimate_err[best];
+    }
+}
+
+// the walls see p V / (V / S) directly. the virial theorem gives the same from the bulk:
+// d pV = 2 <K> + sum r_ij . dp_ij / t + sum r_i |dp_wall| / t, the last term because a centre
+// only gets within r of a wall. the contact estimator replaces the pair virial by its mean per
+// collision, sigma sqrt(2 pi mu kT), times the number of collisions, whose rate is the contact
+// value g(sigma); both hold for hard particles between fixed walls
+void Simulation::startEstimators() {
+    if (piston_speed != 0) {
+        std::cerr << "Cannot estimate pV from the virial with a moving piston, only the walls are used" << std::endl;
+        pv_estimators = false;
+        return;
+    }
+    const double pi = 3.14159265358979323846;
+    ParticleConfig* pc[2] = { pc1, pc2 };
+    for (int a = 0; a < 2; a++)
+        for (int b = a; b < 2; b++) {
+            double sigma = pc[a]->getRadius() + pc[b]->getRadius(),
+                mu = pc[a]->getMass() * pc[b]->getMass() / (pc[a]->getMass() + pc[b]->getMass());
+            contact_factor[a + b] = sigma * sqrt(2 * pi * mu);
+        }
+    kinetic = getKineticEnergy();
+    window_kinetic = 0;
+    window_virial = 0;
+    window_wall_r = 0;
+    for (int l = 0; l < 3; l++) window_contacts[l] = 0;
+    for (int k = 0; k < PV_ESTIMATORS; k++) estimator_series[k].clear();
+}
+
+// before is the velocity the (first) particle of the event had going in
+void Simulation::collectVirial(PhObject* o1, PhObject* o2, const double* before, double dp) {
+    double c1[3], v1[3];
+    PhObject* p = PhObject::isParticle(o1) ? o1 : o2;
+    ParticleConfig pc = particleState(p, c1, v1);
+    if (PhObject::isParticle(o1) && PhObject::isParticle(o2)) {
+        double c2[3], v2[3], w = 0;
+        ParticleConfig other = particleState(o2, c2, v2);
+        for (int k = 0; k < 3; k++) w += (c1[k] - c2[k]) * pc.getMass() * (v1[k] - before[k]);
+        window_virial += w;
+        // a touch that pushed nothing apart is the stuck pair guard, not a collision
+        if (w > 0) window_contacts[(pc.getId() == pc1->getId() ? 0 : 1) + (other.getId() == pc1->getId() ? 0 : 1)]++;
+        return;
+    }
+    // pairs keep the kinetic energy, a wall may not exactly
+    window_wall_r += pc.getRadius() * dp;
+    for (int k = 0; k < 3; k++) kinetic += pc.getMass() * (v1[k] * v1[k] - before[k] * before[k]) / 2;
+}
+
+void Simulation::closeEstimators() {
+    int n = objs_len - walls_len, dim = objs[walls_len]->getType() == PARTICLE_3D ? 3 : 2;
+    // kT from the time averaged kinetic energy of the window, as the collisions saw it
+    double K = window_kinetic / window_dt, kT = 2 * K / dim / n, contact = 0;
+    for (int l = 0; l < 3; l++) contact += window_contacts[l] * contact_factor[l] * sqrt(kT);
+    estimator_series[PV_KINETIC].push_back(2 * K / dim);
+    estimator_series[PV_VIRIAL].push_back((2 * K + (window_virial + window_wall_r) / window_dt) / dim);
+    estimator_series[PV_CONTACT].push_back((2 * K + (contact + window_wall_r) / window_dt) / dim);
+    window_kinetic = 0;
+    window_virial = 0;
+    window_wall_r = 0;
+    for (int l = 0; l < 3; l++) window_contacts[l] = 0;
+}
+
+// not owned; the caller keeps it alive until the simulation is done with it
 void Simulation::setOnSimulationListener(IOnSimulationListener* listener) {
     this->listener = listener;
 }
 
+// storage for the next build comes from arena instead of a private one. the caller keeps it
+// alive and can hand it to the next simulation once this one is destroyed, which resets it
+void Simulation::setArena(Arena* arena) {
+    if (objs != nullptr) {
+        std::cerr << "Cannot change the arena of a built simulation" << std::endl;
+        return;
+    }
+    if (owns_arena) delete this->arena;
+    this->arena = arena;
+    owns_arena = false;
+}
+
+void Simulation::setSeed(unsigned long long seed) {
+    this->seed = seed;
+}
+
+unsigned long long Simulation::getSeed() {
+    return this->seed;
+}
+
+void Simulation::setAdaptive(double tolerance) {
+    this->tolerance = tolerance;
+}
+
+void Simulation::setContainer(std::string path) {
+    this->container_path = path;
+}
+
+void Simulation::setSnapshotLibrary(SnapshotLibrary* snapshots) {
+    this->snapshots = snapshots;
+}
+
+bool Simulation::isWarmStarted() {
+    return warm;
+}
+
+// 0 uses every hardware thread; the result does not depend on it
+void Simulation::setThreadCount(int threads) {
+    this->threads = threads;
+}
+
+void Simulation::setEventQueue(QUEUE_TYPE queue_type) {
+    this->queue_type = queue_type;
+}
+
+// 0 keeps the creation order for the whole run; a reorder costs about as much as objs_len events
+void Simulation::setReorderInterval(long long events) {
+    this->reorder_interval = events;
+}
+
+// the log is written while running; it does not change the results
+void Simulation::setEventLog(std::string path) {
+    this->log_path = path;
+}
+
+// wall slots never change; particles are numbered by creation order after the walls
+int Simulation::externalId(PhObject* o) {
+    if (o->getType() == PARTICLE_2D) return walls_len + static_cast<Particle2D*>(o)->getIndex();
+    if (o->getType() == PARTICLE_3D) return walls_len + static_cast<Particle3D*>(o)->getIndex();
+    for (int l = 0; l < walls_len; l++) if (objs[l] == o) return l;
+    return -1;
+}
+
+// only for validation and experiments; the kernel is not part of the configuration key
+void Simulation::setCollisionKernel(CollisionKernel kernel) {
+    this->kernel = kernel;
+}
+
+double Simulation::getKineticEnergy() {
+    double energy = 0;
+    for (int l = walls_len; l < objs_len; l++) {
+        if (objs[l]->getType() == PARTICLE_3D) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            energy += p->getMass() * p->getVelocity()->scalar(p->getVelocity()) / 2;
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            energy += p->getMass() * p->getVelocity()->scalar(p->getVelocity()) / 2;
+        }
+    }
+    return energy;
+}
+
+// momentum taken up by each wall since initialize, with the number of hits
+int Simulation::getWallImpulse(std::vector<double>& impulse, std::vector<long long>& hits) {
+    impulse = wall_dp;
+    hits = wall_hits;
+    return (int)wall_dp.size();
+}
+
+// density, velocity and temperature per species on resolution^dim bins, handed to
+// OnSimulationFields at the end of every window; 0 disables them
+void Simulation::setFields(int resolution) {
+    field_resolution = resolution;
+}
+
+// publishes the progress under name in shared memory for as long as the simulation lives
+void Simulation::setMonitor(std::string name) {
+    monitor_name = name;
+}
+
+// OnSimulationSample every interval of simulated time; 0 disables it
+void Simulation::setSampling(double interval) {
+    sample_interval = interval;
+}
+
+// MSD and VACF of each species, sampled every interval of simulated time; 0 disables them
+void Simulation::setCorrelation(double interval) {
+    correlation_interval = interval;
+}
+
+// g(r) per species pair up to cutoff in bins, and S(k) at the k_points lowest wave numbers
+// of the box, every interval of simulated time; 0 disables them
+void Simulation::setStructureSampling(double interval, double cutoff, int bins, int k_points) {
+    structure_interval = interval;
+    structure_cutoff = cutoff;
+    structure_bins = bins;
+    structure_k = k_points;
+}
+
+// the +x face of the box moves at speed (m/s, negative compresses) for move_windows windows,
+// then rests for hold_windows; hold_windows = 0 moves it continuously. motion stops at
+// min_width, or at the original width when expanding
+void Simulation::setPiston(double speed, int move_windows, int hold_windows, double min_width) {
+    piston_speed = speed;
+    piston_move = move_windows > 0 ? move_windows : 1;
+    piston_hold = hold_windows > 0 ? hold_windows : 0;
+    piston_min = min_width;
+}
+
+// one point per window: the volume at its end and pV; empty without a piston
+int Simulation::getIsotherm(std::vector<double>& volume, std::vector<double>& pv) {
+    volume = volume_series;
+    pv.assign(pv_series.end() - volume_series.size(), pv_series.end());
+    return (int)volume.size();
+}
+
+// virial, contact and kinetic estimates of pV next to the wall one, and their minimum
+// variance combination, which the adaptive tolerance then uses
+void Simulation::setPressureEstimators(bool enabled) {
+    pv_estimators = enabled;
+}
+
+// particles pass through each other and only the walls count; O(N) per window instead of
+// O(N) per event. needs the built-in box with fixed walls
+void Simulation::setFreeFlight(bool enabled) {
+    free_flight = enabled;
+}
+
+int Simulation::getMSD(int species, std::vector<double>& lags, std::vector<double>& values) {
+    if (msd == nullptr) return 0;
+    return msd->getResult(species, lags, values);
+}
+
+int Simulation::getVACF(int species, std::vector<double>& lags, std::vector<double>& values) {
+    if (vacf == nullptr) return 0;
+    return vacf->getResult(species, lags, values);
+}
+
+int Simulation::getRDF(int a, int b, std::vector<double>& r, std::vector<double>& g) {
+    if (structure == nullptr) return 0;
+    return structure->getRDF(a, b, r, g);
+}
+
+int Simulation::getStructureFactor(std::vector<double>& k, std::vector<double>& s) {
+    if (structure == nullptr) return 0;
+    return structure->getStructureFactor(k, s);
+}
+
+SimulationStats Simulation::getStats() {
+    return stats;
+}
+
+int Simulation::getParticleCount() {
+    return N;
+}
+
+int Simulation::getStepCount() {
+    return (int)pv_series.size();
+}
+
+int Simulation::getEquilibrationStep() {
+    if (estimate_stale) updatePVEstimate();
+    return equilibration_step;
+}
+
+double Simulation::getMeanPV() {
+    if (estimate_stale) updatePVEstimate();
+    return pv_mean;
+}
+
+double Simulation::getStdErrPV() {
+    if (estimate_stale) updatePVEstimate();
+    return pv_err;
+}
+
+// 0 for an estimator that was not enabled; COMBINED falls back to the walls
+double Simulation::getMeanPV(PV_ESTIMATOR estimator) {
+    if (estimate_stale) updatePVEstimate();
+    return estimate_mean[estimator];
+}
+
+double Simulation::getStdErrPV(PV_ESTIMATOR estimator) {
+    if (estimate_stale) updatePVEstimate();
+    return estimate_err[estimator];
+}
+
+// weights of the wall, virial and contact estimators in COMBINED; the wall one is 0 whenever
+// the others are enabled
+int Simulation::getPVWeights(std::vector<double>& weights) {
+    if (estimate_stale) updatePVEstimate();
+    weights = pv_weights;
+    return (int)weights.size();
+}
+
+std::string Simulation::getConfigString() {
+    std::ostringstream ss;
+    ss << std::hexfloat << "kB=" << kB << ";T=" << T << ";hfw=" << hfw
+        << ";pc1=" << pc1->getId() << "," << pc1->getRadius() << "," << pc1->getMass()
+        << ";pc2=" << pc2->getId() << "," << pc2->getRadius() << "," << pc2->getMass()
+        << ";rate=" << rate << ";sim_step=" << sim_step << ";sim_count=" << sim_count
+        << ";N_offset=" << N_offset << ";N_real=" << N_real << ";row=" << row << ";col=" << col
+        << ";tolerance=" << tolerance << ";seed=" << seed << ";version=" << ENGINE_VERSION;
+    if (!container_path.empty()) {
+        // keyed by content, so editing the mesh in place invalidates cached results
+        std::ifstream in(container_path, std::ios::binary);
+        std::ostringstream content;
+        content << in.rdbuf();
+        ss << ";container=" << std::hex << hash(content.str());
+    }
+    if (free_flight) ss << ";flight=1";
+    // the adaptive stop follows the combined estimate
+    if (pv_estimators && tolerance > 0) ss << ";estimators=1";
+    if (piston_speed != 0) ss << ";piston=" << piston_speed << "," << piston_move << "," << piston_hold << "," << piston_min;
+    // outputs a restore has to bring back as well; off they add nothing, so older keys still hold
+    if (sample_interval > 0) ss << ";sampling=" << sample_interval;
+    if (field_resolution > 0) ss << ";fields=" << field_resolution;
+    if (correlation_interval > 0) ss << ";correlation=" << correlation_interval;
+    if (structure_interval > 0) ss << ";structure=" << structure_interval << "," << structure_cutoff << "," << structure_bins << "," << structure_k;
+    if (!log_path.empty()) ss << ";log=1";
+    // the snapshot library is left out: a warm start only shortens the equilibration that MSER
+    // cuts off, the production windows sample the same ensemble as after a cold start, so its
+    // results stand for the cold run's whichever stored state it began from
+    return ss.str();
+}
+
+// FNV-1a
+unsigned long long Simulation::hash(std::string s) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char ch : s) {
+        hash ^= ch;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string Simulation::getConfigKey() {
+    std::ostringstream ss;
+    ss << std::hex;
+    ss.width(16);
+    ss.fill('0');
+    ss << hash(getConfigString());
+    return ss.str();
+}
+
+// runs of one class share their tuned engine settings: dimension, particle count to a power
+// of two and expected packing fraction to a decade
+std::string Simulation::tuningClass(int dim) {
+    int n = N - N_offset < N_real ? N - N_offset : N_real;
+    double p1 = rate < 0 ? 0 : (rate > 1 ? 1 : rate);
+    double r1 = pc1->getRadius(), r2 = pc2->getRadius();
+    double particle = dim == 3 ? 4 * PI * (p1 * r1 * r1 * r1 + (1 - p1) * r2 * r2 * r2) / 3 : PI * (p1 * r1 * r1 + (1 - p1) * r2 * r2);
+    std::ostringstream ss;
+    ss << dim << "d;n=2^" << (n > 1 ? (int)floor(log2((double)n)) : 0);
+    if (!container_path.empty()) ss << ";container";
+    else if (n > 0) ss << ";phi=1e" << (int)floor(log10(n * particle / (dim == 3 ? 8 * hfw * hfw * hfw : 4 * hfw * hfw)));
+    return ss.str();
+}
+
 Simulation::Simulation(double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N_offset, int N_real, int row, int col) {
     this->kB = kB;
     this->T = T;
@@ -759,26 +2248,97 @@ Simulation::Simulation(double kB, double T, double hfw, ParticleConfig* pc1, Par
     this->row = row;
     this->col = col;
     this->listener = nullptr;
+    this->seed = std::chrono::steady_clock::now().time_since_epoch().count();
+    this->tolerance = 0;
+    equilibration_step = 0;
+    pv_mean = 0;
+    pv_err = 0;
+    snapshots = nullptr;
+    packing = 0;
+    mix = 0;
+    warm = false;
     N = 0;
     Vs = 0;
     walls_len = 0;
     objs_len = 0;
     objs = nullptr;
-    all_events_p = nullptr;
+    events_pool = nullptr;
+    queue = nullptr;
+    queue_type = HEAP_QUEUE;
+    threads = 0;
+    stats = SimulationStats();
+    arena = new Arena();
+    owns_arena = true;
+    reorder_interval = 0;
+    log = nullptr;
+    kernel = PhObject::collision;
+    correlation_interval = 0;
+    next_sample = 0;
+    sample_interval = 0;
+    next_snapshot = 0;
+    samples = 0;
+    field_resolution = 0;
+    fields = nullptr;
+    monitor = nullptr;
+    monitor_state = nullptr;
+    monitor_events = 0;
+    msd = nullptr;
+    vacf = nullptr;
+    structure_interval = 0;
+    next_structure = 0;
+    structure_cutoff = 0;
+    structure_bins = 0;
+    structure_k = 0;
+    structure = nullptr;
+    piston_speed = 0;
+    piston_min = 0;
+    piston_move = 1;
+    piston_hold = 0;
+    piston_window = 0;
+    piston_moving = false;
+    pv_estimators = false;
+    kinetic = 0;
+    window_kinetic = 0;
+    window_virial = 0;
+    window_wall_r = 0;
+    for (int l = 0; l < 3; l++) {
+        contact_factor[l] = 0;
+        window_contacts[l] = 0;
+    }
+    for (int k = 0; k < PV_ESTIMATORS; k++) estimate_mean[k] = estimate_err[k] = 0;
+    free_flight = false;
+    flight = nullptr;
+    flight_window = 0;
+    last = nullptr;
+    sim_time = 0;
+    window_dp = 0;
+    window_dt = 0;
+    next_check = 0;
+    estimate_stale = false;
 }
 
 Simulation::~Simulation() {
     delete pc1;
     delete pc2;
     if (objs != nullptr) {
-        for (int l = 0; l < objs_len; l++) delete objs[l];
-        delete[] objs;
-    }
-    if (all_events_p != nullptr) {
-        for (int l = 0; l < (objs_len * (objs_len - 1)) / 2; l++) delete all_events_p[l];
-        delete[] all_events_p;
+        // particles live in the arena, the walls are allocated one by one
+        for (int l = 0; l < objs_len; l++) {
+            if (PhObject::isParticle(objs[l])) objs[l]->~PhObject();
+            else delete objs[l];
+        }
     }
-    if (listener != nullptr) delete listener;
+    // objs, the particles and the events all go back in one step
+    if (owns_arena) delete arena;
+    else arena->reset();
+    if (log != nullptr) delete log;
+    if (msd != nullptr) delete msd;
+    if (vacf != nullptr) delete vacf;
+    if (structure != nullptr) delete structure;
+    if (flight != nullptr) delete flight;
+    if (fields != nullptr) delete fields;
+    if (monitor != nullptr) delete monitor;
+    if (monitor_state != nullptr) delete monitor_state;
+    if (queue != nullptr) delete queue;
 }
 
 Simulation2D::Simulation2D(double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N_offset, int N_real, int row, int col) : Simulation(kB, T, hfw, pc1, pc2, rate, sim_step, sim_count, N_offset, N_real, row, col) {
@@ -791,37 +2351,76 @@ void Simulation2D::setOnSimulationListener(IOnSimulationListener* listener) {
     Simulation::setOnSimulationListener(listener);
 }
 
-void Simulation2D::run() {
-    if (objs_len != 0) return;
-    objs_len = (N - N_offset < N_real ? N - N_offset : N_real) + walls_len;
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::normal_distribution<double> distM_1(0, sqrt(kB * T / pc1->getMass())), distM_2(0, sqrt(kB * T / pc2->getMass()));
-    std::uniform_real_distribution<> distR(0, 1);
-
-    Point2D** exts2D = new Point2D * [4];
-    exts2D[0] = new Point2D(-hfw, -hfw);
-    exts2D[1] = new Point2D(-hfw, hfw);
-    exts2D[2] = new Point2D(hfw, hfw);
-    exts2D[3] = new Point2D(hfw, -hfw);
+std::string Simulation2D::getConfigString() {
+    return "2d;" + Simulation::getConfigString();
+}
 
-    objs = new PhObject * [objs_len];
-    objs[0] = new Line2D(exts2D[0], exts2D[1]);
-    objs[1] = new Line2D(exts2D[1], exts2D[2]);
-    objs[2] = new Line2D(exts2D[2], exts2D[3]);
-    objs[3] = new Line2D(exts2D[3], exts2D[0]);
+std::string Simulation2D::getTuningClass() {
+    return tuningClass(2);
+}
 
-    for (int l = 0; l < 4; l++) delete exts2D[l];
-    delete[] exts2D;
+bool Simulation2D::build() {
+    Container2D* container = nullptr;
+    if (!container_path.empty()) {
+        container = Container2D::load(container_path);
+        if (container == nullptr) {
+            std::cerr << "Cannot load container " << container_path << std::endl;
+            return false;
+        }
+        walls_len = 1;
+        Vs = container->getArea() / container->getPerimeter();
+    }
+    objs_len = (N - N_offset < N_real ? N - N_offset : N_real) + walls_len;
+    std::vector<char> first;
+    std::vector<double> v;
+    sampleSites(2, first, v);
+
+    objs = arena->allocate<PhObject*>(objs_len);
+    if (container != nullptr) objs[0] = container;
+    else {
+        Point2D** exts2D = new Point2D * [4];
+        exts2D[0] = new Point2D(-hfw, -hfw);
+        exts2D[1] = new Point2D(-hfw, hfw);
+        exts2D[2] = new Point2D(hfw, hfw);
+        exts2D[3] = new Point2D(hfw, -hfw);
+
+        // clockwise, so the inside is to the right of every wall
+        objs[0] = new Line2D(exts2D[0], exts2D[1], -1);
+        objs[1] = new Line2D(exts2D[1], exts2D[2], -1);
+        objs[2] = new Line2D(exts2D[2], exts2D[3], -1);
+        objs[3] = new Line2D(exts2D[3], exts2D[0], -1);
+
+        for (int l = 0; l < 4; l++) delete exts2D[l];
+        delete[] exts2D;
+    }
 
     double stepw = 2 * hfw / (row + 1), steph = 2 * hfw / (col + 1);
-    bool isFirstParticle;
+    if (container != nullptr) {
+        stepw = (container->getMax(0) - container->getMin(0)) / (row + 1);
+        steph = (container->getMax(1) - container->getMin(1)) / (col + 1);
+    }
+    int placed = 0;
+    Particle2D* particles = arena->allocate<Particle2D>(objs_len - walls_len);
     for (int l = 0; l < row; l++)
         for (int j = 0; j < col; j++)
             if (l * col + j >= N_offset && l * col + j < N_offset + N_real) {
-                isFirstParticle = distR(rng) < rate;
-                objs[walls_len + l * col + j - N_offset] = new Particle2D(isFirstParticle ? this->pc1 : this->pc2, new Point2D((l - row / 2 + 0.5) * stepw, (j - col / 2 + 0.5) * steph), isFirstParticle ? distM_1(rng) : distM_2(rng), isFirstParticle ? distM_1(rng) : distM_2(rng));
+                int site = l * col + j - N_offset;
+                ParticleConfig* pc = first[site] ? this->pc1 : this->pc2;
+                Point2D c((l - row / 2 + 0.5) * stepw, (j - col / 2 + 0.5) * steph);
+                double vx = v[site * 2], vy = v[site * 2 + 1];
+                if (container != nullptr) {
+                    // lattice over the bounding box; sites outside the container are dropped
+                    c.set(container->getMin(0) + (l + 1) * stepw, container->getMin(1) + (j + 1) * steph);
+                    if (!container->contains(&c, pc->getRadius())) continue;
+                }
+                objs[walls_len + placed] = new (particles + placed) Particle2D(pc, &c, vx, vy);
+                particles[placed].setIndex(placed);
+                placed++;
             }
-    simulate();
+    objs_len = walls_len + placed;
+    if (container != nullptr) N = placed;
+    warmStart(2);
+    return true;
 }
 
 Simulation2D::~Simulation2D() {
@@ -839,50 +2438,90 @@ void Simulation3D::setOnSimulationListener(IOnSimulationListener* listener) {
     Simulation::setOnSimulationListener(listener);
 }
 
-void Simulation3D::run() {
-    if (objs_len != 0) return;
+std::string Simulation3D::getConfigString() {
+    return "3d;stack=" + std::to_string(stack) + ";" + Simulation::getConfigString();
+}
+
+std::string Simulation3D::getTuningClass() {
+    return tuningClass(3);
+}
+
+bool Simulation3D::build() {
+    Container3D* container = nullptr;
+    if (!container_path.empty()) {
+        container = Container3D::load(container_path);
+        if (container == nullptr) {
+            std::cerr << "Cannot load container " << container_path << std::endl;
+            return false;
+        }
+        walls_len = 1;
+        Vs = container->getVolume() / container->getSurface();
+    }
     objs_len = (N - N_offset < N_real ? N - N_offset : N_real) + walls_len;
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::normal_distribution<double> distM_1(0, sqrt(kB * T / pc1->getMass())), distM_2(0, sqrt(kB * T / pc2->getMass()));
-    std::uniform_real_distribution<> distR(0, 1);
-
-    Point3D** exts3D = new Point3D * [8];
-    exts3D[0] = new Point3D(-hfw, -hfw, hfw);
-    exts3D[1] = new Point3D(-hfw, hfw, hfw);
-    exts3D[2] = new Point3D(hfw, hfw, hfw);
-    exts3D[3] = new Point3D(hfw, -hfw, hfw);
-    exts3D[4] = new Point3D(-hfw, -hfw, -hfw);
-    exts3D[5] = new Point3D(-hfw, hfw, -hfw);
-    exts3D[6] = new Point3D(hfw, hfw, -hfw);
-    exts3D[7] = new Point3D(hfw, -hfw, -hfw);
-
-    objs = new PhObject * [objs_len];
-    objs[0] = new Triangle(exts3D[0], exts3D[1], exts3D[2]);
-    objs[1] = new Triangle(exts3D[0], exts3D[1], exts3D[3]);
-    objs[2] = new Triangle(exts3D[4], exts3D[5], exts3D[6]);
-    objs[3] = new Triangle(exts3D[4], exts3D[5], exts3D[7]);
-    objs[4] = new Triangle(exts3D[0], exts3D[1], exts3D[4]);
-    objs[5] = new Triangle(exts3D[0], exts3D[1], exts3D[5]);
-    objs[6] = new Triangle(exts3D[2], exts3D[3], exts3D[6]);
-    objs[7] = new Triangle(exts3D[2], exts3D[3], exts3D[7]);
-    objs[8] = new Triangle(exts3D[0], exts3D[3], exts3D[4]);
-    objs[9] = new Triangle(exts3D[0], exts3D[3], exts3D[7]);
-    objs[10] = new Triangle(exts3D[1], exts3D[2], exts3D[5]);
-    objs[11] = new Triangle(exts3D[1], exts3D[2], exts3D[6]);
-
-    for (int l = 0; l < 8; l++) delete exts3D[l];
-    delete[] exts3D;
+    std::vector<char> first;
+    std::vector<double> v;
+    sampleSites(3, first, v);
+
+    objs = arena->allocate<PhObject*>(objs_len);
+    if (container != nullptr) objs[0] = container;
+    else {
+        Point3D** exts3D = new Point3D * [8];
+        exts3D[0] = new Point3D(-hfw, -hfw, hfw);
+        exts3D[1] = new Point3D(-hfw, hfw, hfw);
+        exts3D[2] = new Point3D(hfw, hfw, hfw);
+        exts3D[3] = new Point3D(hfw, -hfw, hfw);
+        exts3D[4] = new Point3D(-hfw, -hfw, -hfw);
+        exts3D[5] = new Point3D(-hfw, hfw, -hfw);
+        exts3D[6] = new Point3D(hfw, hfw, -hfw);
+        exts3D[7] = new Point3D(hfw, -hfw, -hfw);
+
+        // two triangles per face, split along a diagonal so that together they cover it;
+        // all are wound with the normal pointing into the box
+        objs[0] = new Triangle(exts3D[0], exts3D[1], exts3D[2], 1);
+        objs[1] = new Triangle(exts3D[0], exts3D[2], exts3D[3], 1);
+        objs[2] = new Triangle(exts3D[4], exts3D[6], exts3D[5], 1);
+        objs[3] = new Triangle(exts3D[4], exts3D[7], exts3D[6], 1);
+        objs[4] = new Triangle(exts3D[0], exts3D[5], exts3D[1], 1);
+        objs[5] = new Triangle(exts3D[0], exts3D[4], exts3D[5], 1);
+        objs[6] = new Triangle(exts3D[3], exts3D[2], exts3D[6], 1);
+        objs[7] = new Triangle(exts3D[3], exts3D[6], exts3D[7], 1);
+        objs[8] = new Triangle(exts3D[0], exts3D[3], exts3D[7], 1);
+        objs[9] = new Triangle(exts3D[0], exts3D[7], exts3D[4], 1);
+        objs[10] = new Triangle(exts3D[1], exts3D[6], exts3D[2], 1);
+        objs[11] = new Triangle(exts3D[1], exts3D[5], exts3D[6], 1);
+
+        for (int l = 0; l < 8; l++) delete exts3D[l];
+        delete[] exts3D;
+    }
 
     double stepw = 2 * hfw / (row + 1), steph = 2 * hfw / (col + 1), steps = 2 * hfw / (stack + 1);
-    bool isFirstParticle;
+    if (container != nullptr) {
+        stepw = (container->getMax(0) - container->getMin(0)) / (row + 1);
+        steph = (container->getMax(1) - container->getMin(1)) / (col + 1);
+        steps = (container->getMax(2) - container->getMin(2)) / (stack + 1);
+    }
+    int placed = 0;
+    Particle3D* particles = arena->allocate<Particle3D>(objs_len - walls_len);
     for (int l = 0; l < row; l++)
         for (int j = 0; j < col; j++)
             for (int k = 0; k < stack; k++)
                 if (l * col * stack + j * stack + k >= N_offset && l * col * stack + j * stack + k < N_offset + N_real) {
-                    isFirstParticle = distR(rng) < rate;
-                    objs[walls_len + l * col * stack + j * stack + k - N_offset] = new Particle3D(isFirstParticle ? this->pc1 : this->pc2, new Point3D((l - row / 2 + 0.5) * stepw, (j - col / 2 + 0.5) * steph, (k - stack / 2 + 0.5) * steps), isFirstParticle ? distM_1(rng) : distM_2(rng), isFirstParticle ? distM_1(rng) : distM_2(rng), isFirstParticle ? distM_1(rng) : distM_2(rng));
+                    int site = l * col * stack + j * stack + k - N_offset;
+                    ParticleConfig* pc = first[site] ? this->pc1 : this->pc2;
+                    Point3D c((l - row / 2 + 0.5) * stepw, (j - col / 2 + 0.5) * steph, (k - stack / 2 + 0.5) * steps);
+                    double vx = v[site * 3], vy = v[site * 3 + 1], vz = v[site * 3 + 2];
+                    if (container != nullptr) {
+                        c.set(container->getMin(0) + (l + 1) * stepw, container->getMin(1) + (j + 1) * steph, container->getMin(2) + (k + 1) * steps);
+                        if (!container->contains(&c, pc->getRadius())) continue;
+                    }
+                    objs[walls_len + placed] = new (particles + placed) Particle3D(pc, &c, vx, vy, vz);
+                    particles[placed].setIndex(placed);
+                    placed++;
                 }
-    simulate();
+    objs_len = walls_len + placed;
+    if (container != nullptr) N = placed;
+    warmStart(3);
+    return true;
 }
 
 Simulation3D::~Simulation3D() {
@@ -1,18 +1,45 @@
 #include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "bvh.h"
+#include "vecmath.h"
+#include "rng.h"
 #ifndef H_GEOMETRY
 #define H_GEOMETRY
 
 #define NOT_COLLIDING -1
 #define INSIDE_EACH_OTHER -2
 #define UNKNOWN -3
-enum TYPE {LINE_2D, PARTICLE_2D, TRIANGLE, PARTICLE_3D};
+#define ENGINE_VERSION "5"
+enum TYPE {LINE_2D, PARTICLE_2D, TRIANGLE, PARTICLE_3D, CONTAINER_2D, CONTAINER_3D};
+enum QUEUE_TYPE {MULTISET_QUEUE, HEAP_QUEUE};
+// estimators of pV; KINETIC is the ideal gas term alone, COMBINED the minimum variance mix of VIRIAL and CONTACT
+enum PV_ESTIMATOR {PV_WALL, PV_VIRIAL, PV_CONTACT, PV_KINETIC, PV_COMBINED};
+#define PV_ESTIMATORS 5
 
 class PhObject;
+class SnapshotLibrary;
+class EventQueue;
+class EventLog;
+class MultiTauCorrelator;
+class StructureSampler;
+class FreeFlight;
+class FieldGrid;
+class Monitor;
+class Arena;
+struct MonitorState;
+class Particle2D;
+class Particle3D;
+
+// PhObject::collision signature; act < -0.5 predicts, otherwise the event is carried out
+typedef double (*CollisionKernel)(PhObject* o1, PhObject* o2, double act);
 
 class Event {
 	public:
 		PhObject* o1, *o2;
 		double t, dt;
+		int heap_index;
 		Event();
 		Event(PhObject* o1, PhObject* o2, double t, double dt);
 		static bool compare(Event* e1, Event* e2);
@@ -23,14 +50,16 @@ class Point2D {
 		double x, y;
 	
 	public:
-		Point2D(double x, double y);
-		Point2D(Point2D *p);
+		constexpr Point2D(double x, double y) : x(x), y(y) {}
+		Point2D(Point2D *p) : x(p->x), y(p->y) {}
 		
-		double getX();
-		double getY();
+		constexpr double getX() const { return x; }
+		constexpr double getY() const { return y; }
+		constexpr Vec2 vec() const { return Vec2(x, y); }
 		
-		void set(double x, double y);
-		void add(double dx, double dy);
+		void set(double x, double y) { this->x = x; this->y = y; }
+		void set(const Vec2& p) { x = p.x; y = p.y; }
+		void add(double dx, double dy) { x += dx; y += dy; }
 		std::string toString();
 		static double distance(Point2D *p1, Point2D *p2);
 };
@@ -40,15 +69,17 @@ protected:
 	double x, y, z;
 
 public:
-	Point3D(double x, double y, double z);
-	Point3D(Point3D* p);
+	constexpr Point3D(double x, double y, double z) : x(x), y(y), z(z) {}
+	Point3D(Point3D* p) : x(p->x), y(p->y), z(p->z) {}
 
-	double getX();
-	double getY();
-	double getZ();
+	constexpr double getX() const { return x; }
+	constexpr double getY() const { return y; }
+	constexpr double getZ() const { return z; }
+	constexpr Vec3 vec() const { return Vec3(x, y, z); }
 
-	void set(double x, double y, double z);
-	void add(double dx, double dy, double dz);
+	void set(double x, double y, double z) { this->x = x; this->y = y; this->z = z; }
+	void set(const Vec3& p) { x = p.x; y = p.y; z = p.z; }
+	void add(double dx, double dy, double dz) { x += dx; y += dy; z += dz; }
 	std::string toString();
 	static double distance(Point3D* p1, Point3D* p2);
 };
@@ -59,26 +90,39 @@ class PhObject {
 		int events_n;
 	public:
 		PhObject();
-		void initEvents(int n);
+		void initEvents(int n, Event** events);
 		int getEventsLen();
 		Event** getEvents();
 		virtual void progress(double t) = 0;
 		static double collision(PhObject *o1, PhObject *o2, double act);
 		static bool compare(PhObject* o1, PhObject* o2);
+		static bool isParticle(PhObject* o);
 		virtual TYPE getType() = 0;
 		virtual std::string toString() = 0;
-		~PhObject();
+		virtual ~PhObject();
 };
 
 class Line2D : public PhObject {
 	protected:
 		Point2D *p1, *p2;
+		int side;
+		// unit direction p1 -> p2, its left normal and the length, fixed at construction
+		Vec2 unit, normal;
+		double length;
+		Vec2 velocity;
 		TYPE getType();
 	
 	public:
 		Line2D(Point2D *p1, Point2D *p2);
+		Line2D(Point2D *p1, Point2D *p2, int side);
 		Point2D * getFirstPoint();
 		Point2D * getSecondPoint();
+		int getSide();
+		void setVelocity(double vx, double vy);
+		Vec2 getVelocity();
+		double hitTime(Particle2D* p);
+		Point2D closestPoint(Point2D* c);
+		double reflect(Particle2D* p);
 		void progress(double t);
 		std::string toString();
 		~Line2D();
@@ -87,13 +131,26 @@ class Line2D : public PhObject {
 class Triangle : public PhObject {
 protected:
 	Point3D* p1, * p2, * p3;
+	int side;
+	// fixed at construction: edges from p1, unit normal, the barycentric denominators and the
+	// unit direction and length of every edge
+	Vec3 e1, e2, normal, edge[3];
+	double d00, d01, d11, den, edge_length[3];
+	Vec3 velocity;
 	TYPE getType();
 
 public:
 	Triangle(Point3D* p1, Point3D* p2, Point3D* p3);
+	Triangle(Point3D* p1, Point3D* p2, Point3D* p3, int side);
 	Point3D* getFirstPoint();
 	Point3D* getSecondPoint();
 	Point3D* getThirdPoint();
+	int getSide();
+	void setVelocity(double vx, double vy, double vz);
+	Vec3 getVelocity();
+	double hitTime(Particle3D* p);
+	Point3D closestPoint(Point3D* c);
+	double reflect(Particle3D* p);
 	void progress(double t);
 	std::string toString();
 	~Triangle();
@@ -104,17 +161,19 @@ class Vector2D {
 		double x, y;
 	
 	public:
-		Vector2D(double x, double y);
+		constexpr Vector2D(double x, double y) : x(x), y(y) {}
 		Vector2D(Point2D *p1, Point2D *p2);
 		Vector2D(Point2D *p1, Point2D *p2, bool normalize);
-		Vector2D(Vector2D *v);
+		Vector2D(Vector2D *v) : x(v->x), y(v->y) {}
 		
-		double getX();
-		double getY();
-		void set(double x, double y);
+		constexpr double getX() const { return x; }
+		constexpr double getY() const { return y; }
+		constexpr Vec2 vec() const { return Vec2(x, y); }
+		void set(double x, double y) { this->x = x; this->y = y; }
+		void set(const Vec2& v) { x = v.x; y = v.y; }
 		double len();
-		void multiply(double m);
-		double scalar(Vector2D *v);
+		void multiply(double m) { x *= m; y *= m; }
+		double scalar(Vector2D *v) { return x * v->x + y * v->y; }
 		std::string toString();
 		
 		static Vector2D projection(Vector2D *v_orig, Vector2D *v_on);
@@ -127,18 +186,20 @@ protected:
 	double x, y, z;
 
 public:
-	Vector3D(double x, double y, double z);
+	constexpr Vector3D(double x, double y, double z) : x(x), y(y), z(z) {}
 	Vector3D(Point3D* p1, Point3D* p2);
 	Vector3D(Point3D* p1, Point3D* p2, bool normalize);
-	Vector3D(Vector3D* v);
+	Vector3D(Vector3D* v) : x(v->x), y(v->y), z(v->z) {}
 
-	double getX();
-	double getY();
-	double getZ();
-	void set(double x, double y, double z);
+	constexpr double getX() const { return x; }
+	constexpr double getY() const { return y; }
+	constexpr double getZ() const { return z; }
+	constexpr Vec3 vec() const { return Vec3(x, y, z); }
+	void set(double x, double y, double z) { this->x = x; this->y = y; this->z = z; }
+	void set(const Vec3& v) { x = v.x; y = v.y; z = v.z; }
 	double len();
-	void multiply(double m);
-	double scalar(Vector3D* v);
+	void multiply(double m) { x *= m; y *= m; z *= m; }
+	double scalar(Vector3D* v) { return x * v->x + y * v->y + z * v->z; }
 	std::string toString();
 	
 	static Vector3D vector(Vector3D* v1, Vector3D* v2, bool normalize);
@@ -160,10 +221,13 @@ public:
 	double getMass();
 };
 
+// the state is stored inline, so a contiguous array of particles is also contiguous in memory;
+// index is the creation order and follows the particle when storage is reordered
 class Particle2D : public PhObject, ParticleConfig {
 	protected:
-		Point2D *c;
-		Vector2D *v;
+		Point2D c;
+		Vector2D v;
+		int index;
 		TYPE getType();
 	
 	public:
@@ -174,6 +238,9 @@ class Particle2D : public PhObject, ParticleConfig {
 		int getId();
 		double getRadius();
 		double getMass();
+		int getIndex();
+		void setIndex(int index);
+		void assign(Particle2D* p);
 		void progress(double t);
 		std::string toString();
 		~Particle2D();
@@ -181,8 +248,9 @@ class Particle2D : public PhObject, ParticleConfig {
 
 class Particle3D : public PhObject, ParticleConfig {
 protected:
-	Point3D* c;
-	Vector3D* v;
+	Point3D c;
+	Vector3D v;
+	int index;
 	TYPE getType();
 
 public:
@@ -193,54 +261,262 @@ public:
 	int getId();
 	double getRadius();
 	double getMass();
+	int getIndex();
+	void setIndex(int index);
+	void assign(Particle3D* p);
 	void progress(double t);
 	std::string toString();
 	~Particle3D();
 };
 
+class Container2D : public PhObject {
+protected:
+	std::vector<Line2D*> segments;
+	BVH* bvh;
+	double area, perimeter;
+	double lo[2], hi[2];
+	TYPE getType();
+
+public:
+	Container2D(std::vector<Point2D>& vertices, std::vector<int>& indices);
+	static Container2D* load(std::string path);
+	int getSegmentCount();
+	Line2D* getSegment(int l);
+	double getArea();
+	double getPerimeter();
+	double getMin(int axis);
+	double getMax(int axis);
+	bool contains(Point2D* c, double clearance);
+	double hitTime(Particle2D* p);
+	double reflect(Particle2D* p);
+	void progress(double t);
+	std::string toString();
+	~Container2D();
+};
+
+class Container3D : public PhObject {
+protected:
+	std::vector<Triangle*> facets;
+	BVH* bvh;
+	double volume, surface;
+	double lo[3], hi[3];
+	TYPE getType();
+
+public:
+	Container3D(std::vector<Point3D>& vertices, std::vector<int>& indices);
+	static Container3D* load(std::string path);
+	int getFacetCount();
+	Triangle* getFacet(int l);
+	double getVolume();
+	double getSurface();
+	double getMin(int axis);
+	double getMax(int axis);
+	bool contains(Point3D* c, double clearance);
+	double hitTime(Particle3D* p);
+	double reflect(Particle3D* p);
+	void progress(double t);
+	std::string toString();
+	~Container3D();
+};
+
+// objs may be reordered between calls; Particle2D/3D::getIndex() identifies a particle.
+// the simulation does not own its listener
 class IOnSimulationListener {
 public:
 	virtual void OnSimulationStart(PhObject** objs, int objs_len) = 0;
 	virtual void OnSimulationIteration(PhObject** objs, int objs_len, int sim_ite) = 0;
 	virtual void OnSimulationStep(double pV, double NkBT, int sim_step) = 0;
 	virtual void OnSimulationEnd(PhObject** objs, int objs_len) = 0;
+	// every sampling interval of simulated time, with the particles at exactly t; objs must not be
+	// changed. unlike OnSimulationIteration its cost does not grow with the number of events
+	virtual void OnSimulationSample(PhObject** objs, int objs_len, double t, int sample) {}
+	// at the end of every window when fields are enabled, with the window ending at t
+	virtual void OnSimulationFields(FieldGrid* fields, double t, int window) {}
+	// just before OnSimulationEnd when correlations are enabled; groups are the two species
+	virtual void OnSimulationCorrelations(MultiTauCorrelator* msd, MultiTauCorrelator* vacf) {}
+	// likewise for the g(r) and S(k) sampler
+	virtual void OnSimulationStructure(StructureSampler* structure) {}
+	virtual ~IOnSimulationListener() {}
+};
+
+// wall clock seconds; startup covers everything before the first event
+struct SimulationStats {
+	double prediction, queue_build, startup, run, reorder;
+	long long events;
+	int threads, reorders;
 };
 
 class Simulation {
 protected:
 	int row, col, N, walls_len, objs_len, N_offset, N_real;
 	long long sim_step, sim_count;
-	double kB, T, hfw, Vs, rate;
+	unsigned long long seed;
+	double kB, T, hfw, Vs, rate, tolerance;
+	std::string container_path;
+	int equilibration_step;
+	double pv_mean, pv_err;
+	std::vector<double> pv_series;
+	SnapshotLibrary* snapshots;
+	double packing, mix;
+	bool warm;
 	ParticleConfig* pc1, * pc2;
 	PhObject** objs;
-	Event** all_events_p;
+	Event* events_pool;
+	EventQueue* queue;
+	QUEUE_TYPE queue_type;
+	int threads;
+	SimulationStats stats;
+	Arena* arena;
+	bool owns_arena;
+	long long reorder_interval;
+	std::string log_path;
+	CollisionKernel kernel;
+	std::vector<double> wall_dp;
+	std::vector<long long> wall_hits;
+	double sample_interval, next_snapshot;
+	int samples;
+	int field_resolution;
+	FieldGrid* fields;
+	std::string monitor_name;
+	Monitor* monitor;
+	MonitorState* monitor_state;
+	std::chrono::steady_clock::time_point monitor_start, monitor_last;
+	long long monitor_events;
+	double correlation_interval, next_sample;
+	MultiTauCorrelator* msd, * vacf;
+	std::vector<double> sample_c, sample_v;
+	double structure_interval, next_structure, structure_cutoff;
+	int structure_bins, structure_k;
+	StructureSampler* structure;
+	double piston_speed, piston_min;
+	int piston_move, piston_hold, piston_window;
+	bool piston_moving;
+	std::vector<int> piston_walls;
+	std::vector<double> volume_series;
+	bool pv_estimators;
+	double kinetic, window_kinetic, window_virial, window_wall_r, contact_factor[3];
+	long long window_contacts[3];
+	std::vector<double> estimator_series[PV_ESTIMATORS];
+	double estimate_mean[PV_ESTIMATORS], estimate_err[PV_ESTIMATORS];
+	std::vector<double> pv_weights;
+	bool free_flight;
+	FreeFlight* flight;
+	double flight_window;
+	int externalId(PhObject* o);
 	IOnSimulationListener* listener;
-	void simulate();
+	CounterRNG random;
+	double sim_time, window_dp, window_dt;
+	int next_check;
+	bool estimate_stale;
+	Event* last;
+	EventLog* log;
+	static unsigned long long hash(std::string s);
+	std::string tuningClass(int dim);
+	virtual bool build() = 0;
+	bool processEvent();
+	void updatePVEstimate();
+	void startEstimators();
+	void collectVirial(PhObject* o1, PhObject* o2, const double* before, double dp);
+	void closeEstimators();
+	void predictAll(double t);
+	void reorder(Event*& last);
+	void warmTarget(int dim, int& n, double& packing, double& mix);
+	bool warmStart(int dim);
+	void storeSnapshot(int dim);
+	void stateAt(double t);
+	void sampleAt(double t);
+	void flushField(PhObject* o, double t);
+	void startMonitor();
+	void publish(bool finished);
+	void sample(double t);
+	void sampleStructure(double t);
+	bool findPiston();
+	double pistonWidth();
+	void setPistonVelocity(double speed);
+	void advancePiston();
+	void thermostat();
+	double jitter(Event* e);
+	bool startFlight();
+	void flyTo(double t);
+	bool flightWindow();
+	void syncFlight();
+	void setState(const std::vector<double>& positions, const std::vector<double>& velocities);
+	void sampleSites(int dim, std::vector<char>& first, std::vector<double>& v);
 
 public:
 	Simulation(double kB, double T, double hfw, ParticleConfig *pc1, ParticleConfig *pc2, double rate, long long sim_step, long long sim_count, int N_offset, int N_real, int row, int col);
 	void setOnSimulationListener(IOnSimulationListener* listener);
-	virtual void run() = 0;
-	~Simulation();
+	void setArena(Arena* arena);
+	void setSeed(unsigned long long seed);
+	unsigned long long getSeed();
+	void setAdaptive(double tolerance);
+	void setContainer(std::string path);
+	void setSnapshotLibrary(SnapshotLibrary* snapshots);
+	bool isWarmStarted();
+	void setThreadCount(int threads);
+	void setEventQueue(QUEUE_TYPE queue_type);
+	void setReorderInterval(long long events);
+	void setEventLog(std::string path);
+	void setCollisionKernel(CollisionKernel kernel);
+	void setSampling(double interval);
+	void setFields(int resolution);
+	void setMonitor(std::string name);
+	void setCorrelation(double interval);
+	void setStructureSampling(double interval, double cutoff, int bins, int k_points);
+	void setPiston(double speed, int move_windows, int hold_windows, double min_width);
+	void setFreeFlight(bool enabled);
+	void setPressureEstimators(bool enabled);
+	SimulationStats getStats();
+	int getParticleCount();
+	int getStepCount();
+	int getEquilibrationStep();
+	double getMeanPV();
+	double getStdErrPV();
+	double getMeanPV(PV_ESTIMATOR estimator);
+	double getStdErrPV(PV_ESTIMATOR estimator);
+	int getPVWeights(std::vector<double>& weights);
+	virtual std::string getConfigString();
+	std::string getConfigKey();
+	virtual std::string getTuningClass() = 0;
+	bool initialize();
+	void run();
+	long long step(long long n);
+	long long advanceTo(double time);
+	double getTime();
+	long long getEventCount();
+	double getKineticEnergy();
+	int getWallImpulse(std::vector<double>& impulse, std::vector<long long>& hits);
+	int getMSD(int species, std::vector<double>& lags, std::vector<double>& values);
+	int getVACF(int species, std::vector<double>& lags, std::vector<double>& values);
+	int getRDF(int a, int b, std::vector<double>& r, std::vector<double>& g);
+	int getStructureFactor(std::vector<double>& k, std::vector<double>& s);
+	int getIsotherm(std::vector<double>& volume, std::vector<double>& pv);
+	int snapshot(std::vector<double>& positions, std::vector<double>& velocities);
+	virtual ~Simulation();
 };
 
-class Simulation2D : Simulation {
+class Simulation2D : public Simulation {
+protected:
+	bool build();
 
 public:
 	Simulation2D(double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N_offset, int N_real, int row, int col);
 	void setOnSimulationListener(IOnSimulationListener* listener);
-	void run();
+	std::string getConfigString();
+	std::string getTuningClass();
 	~Simulation2D();
 };
 
-class Simulation3D : Simulation {
+class Simulation3D : public Simulation {
 protected:
 	int stack;
+	bool build();
 
 public:
 	Simulation3D(double kB, double T, double hfw, ParticleConfig* pc1, ParticleConfig* pc2, double rate, long long sim_step, long long sim_count, int N_offset, int N_real, int row, int col, int stack);
 	void setOnSimulationListener(IOnSimulationListener* listener);
-	void run();
+	std::string getConfigString();
+	std::string getTuningClass();
 	~Simulation3D();
 };
 
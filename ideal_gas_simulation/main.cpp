@@ -1,4 +1,16 @@
 #include "geometry.h"
+#include "cache.h"
+#include "sweep.h"
+#include "snapshot.h"
+#include "autotune.h"
+#include "validation.h"
+#include "correlator.h"
+#include "structure.h"
+#include "dsmc.h"
+#include "fields.h"
+#include "analysis.h"
+#include "monitor.h"
+#include "arena.h"
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -28,13 +40,15 @@ public:
 		/*if (sim_ite % 100 == 0) {
 			for (int l = 0; l < objs_len; l++) cout << sim_ite << " " << l << " " << objs[l]->toString() << endl;
 		}*/
-		if (sim_ite == 7 || sim_ite == 500 || sim_ite == 1077) {
-			std::ofstream myfile;
-			myfile.open(prefix + "/" + name + "_intensities_" + std::to_string(sim_ite) + "_.txt");
-			for (int l = 0; l < objs_len; l++)
-				if (objs[l]->getType() == PARTICLE_2D) myfile << (static_cast<Particle2D*>(objs[l]))->getVelocity()->len() << std::endl;
-			myfile.close();
-		}
+	}
+
+	// raspodela brzina u jednako razmaknutim trenucima, umesto posle 7., 500. i 1077. dogadjaja
+	void OnSimulationSample(PhObject** objs, int objs_len, double t, int sample) {
+		std::ofstream myfile;
+		myfile.open(prefix + "/" + name + "_intensities_" + std::to_string(sample) + "_.txt");
+		for (int l = 0; l < objs_len; l++)
+			if (objs[l]->getType() == PARTICLE_2D) myfile << (static_cast<Particle2D*>(objs[l]))->getVelocity()->len() << std::endl;
+		myfile.close();
 	}
 
 	void OnSimulationStep(double pV, double NkBT, int sim_step) {
@@ -42,6 +56,19 @@ public:
 		//std::cout << sim_step << ". " << pV << " " << NkBT << std::endl;
 	}
 
+	void OnSimulationFields(FieldGrid* fields, double t, int window) {
+		fields->write(prefix + "/" + name + "_fields.bin", t);
+	}
+
+	void OnSimulationCorrelations(MultiTauCorrelator* msd, MultiTauCorrelator* vacf) {
+		msd->write(prefix + "/" + name + "_msd.txt");
+		vacf->write(prefix + "/" + name + "_vacf.txt");
+	}
+
+	void OnSimulationStructure(StructureSampler* structure) {
+		structure->write(prefix + "/" + name + "_rdf.txt", prefix + "/" + name + "_sk.txt");
+	}
+
 	void OnSimulationEnd(PhObject** objs, int objs_len) {
 		myfile.close();
 		myfile.open(prefix + "/" + name + "_intensities.txt");
@@ -62,14 +89,116 @@ string toStringScientific(double t) {
 }
 
 int main(int argc, char** argv) {
+	// rasporedjeno izvrsavanje: plan <opis> <manifest> | worker <manifest> <i> <n> <izlaz> [sati] | merge <manifest> <izlaz> <skup>
+	// provera optimizovanog motora prema referentnom: validate [dogadjaji]
+	// razredjeni gas metodom DSMC: dsmc <dim> <hfw> <cestice> <tezina>, svaka cestica zamenjuje tezina stvarnih
+	// obrada postojecih izlaza (pV, pV/NkBT, raspodela brzina) u jednu tabelu: analyze <tabela> <direktorijum>...
+	// stanje simulacija koje su u toku, iz drugog procesa: monitor <ime>... (ime je igs_<kljuc konfiguracije>_<pid>)
+	string mode = argc > 1 ? argv[1] : "";
+	if (mode == "plan" && argc == 4) {
+		int count = Sweep::plan(argv[2], argv[3]);
+		if (count < 0) return 1;
+		std::cout << "Manifest " << argv[3] << ": " << count << " simulacija" << std::endl;
+		return 0;
+	}
+	if (mode == "worker" && (argc == 6 || argc == 7)) {
+		int count = Sweep::work(argv[2], argv[5], atoi(argv[3]), atoi(argv[4]), argc == 7 ? atof(argv[6]) : 0);
+		if (count < 0) return 1;
+		std::cout << "Zavrseno! (" << count << " simulacija)" << std::endl;
+		return 0;
+	}
+	if (mode == "merge" && argc == 5) {
+		return Sweep::merge(argv[2], argv[3], argv[4]) == 0 ? 0 : 2;
+	}
+	if (mode == "validate" && (argc == 2 || argc == 3)) {
+		// referentni motor protiv podrazumevanih podesavanja, uz preuredjivanje da bi i ono bilo provereno
+		long long events = argc == 3 ? atoll(argv[2]) : 500;
+		ParticleConfig pc1(0, 1e-6, 1), pc2(1, 5e-6, 2);
+		std::vector<std::function<Simulation*()>> configs = {
+			[&]() { Simulation* sim = new Simulation2D(1.3806503e-23, 303, 1e5, &pc1, &pc2, 1.1, 50, 200, 0, 100, 10, 10); sim->setSeed(1); return sim; },
+			[&]() { Simulation* sim = new Simulation2D(1.3806503e-23, 303, 2e-4, &pc1, &pc2, 0.5, 50, 200, 0, 400, 20, 20); sim->setSeed(2); return sim; },
+			[&]() { Simulation* sim = new Simulation3D(1.3806503e-23, 303, 1e-4, &pc1, &pc2, 0.5, 50, 200, 0, 125, 5, 5, 5); sim->setSeed(3); return sim; }
+		};
+		bool passed = true;
+		for (size_t l = 0; l < configs.size(); l++) {
+			Validator validator(configs[l], [](Simulation* sim) {
+				EngineSettings settings = AutoTuner::defaults();
+				settings.reorder_per_particle = 16;
+				AutoTuner::apply(sim, settings);
+			});
+			// od verzije 4 jezgro racuna bez projekcija, pa se putanje razlikuju na nivou zaokruzivanja
+			validator.setTolerances(1e-6, 1e-9, 5);
+			ValidationReport report = validator.validate(events);
+			std::cout << "Konfiguracija " << l + 1 << "/" << configs.size() << std::endl << Validator::toString(report) << std::endl << std::endl;
+			passed = passed && report.passed;
+		}
+		return passed ? 0 : 3;
+	}
+	if (mode == "dsmc" && argc == 6) {
+		ParticleConfig pc1(0, 1e-6, 1), pc2(1, 5e-6, 2);
+		SimulationDSMC dsmc(atoi(argv[2]), 1.3806503e-23, 303, atof(argv[3]), &pc1, &pc2, 1.1, 20, 1000, atoi(argv[4]), atof(argv[5]));
+		dsmc.setSeed(1);
+		dsmc.run();
+		std::cout << "pV = " << dsmc.getMeanPV() << " +- " << dsmc.getStdErrPV() << ", NkBT = " << dsmc.getParticleCount() * atof(argv[5]) * 1.3806503e-23 * 303 << std::endl;
+		std::cout << dsmc.getCollisionCount() << " sudara, " << dsmc.getCellCount() << " celija, korak " << dsmc.getTimeStep() << " s" << std::endl;
+		return 0;
+	}
+	if (mode == "analyze" && argc >= 4) {
+		std::vector<std::string> dirs(argv + 3, argv + argc);
+		// mase vrsta kao u glavnoj simulaciji ispod
+		std::vector<RunSummary> runs = Analysis::analyze(dirs, 1.3806503e-23, 303, 1, 2, 0);
+		if (Analysis::write(runs, argv[2]) < 0) return 1;
+		std::cout << "Tabela " << argv[2] << ": " << runs.size() << " simulacija" << std::endl;
+		return 0;
+	}
+	if (mode == "monitor" && argc >= 3) {
+		int missing = 0;
+		for (int l = 2; l < argc; l++) {
+			Monitor* monitor = Monitor::open(argv[l]);
+			MonitorState state;
+			if (monitor->isOpen() && monitor->read(state)) std::cout << argv[l] << ": " << Monitor::toString(state) << std::endl << std::endl;
+			else {
+				std::cerr << "Cannot open monitor " << argv[l] << std::endl;
+				missing++;
+			}
+			delete monitor;
+		}
+		return missing == 0 ? 0 : 1;
+	}
+	if (!mode.empty()) {
+		std::cerr << "Upotreba: " << argv[0] << " [plan <opis> <manifest> | worker <manifest> <i> <n> <izlaz> [sati] | merge <manifest> <izlaz> <skup> | validate [dogadjaji] | dsmc <dim> <hfw> <cestice> <tezina> | analyze <tabela> <direktorijum>... | monitor <ime>...]" << std::endl;
+		return 1;
+	}
+
 	const double kB = 1.3806503e-23, T = 273 + 30,
 		hfw = 1e5, r_1 = 1e-6, r_2 = 5e-6, m_1 = 1, m_2 = 2;
 	const int row = 4, col = 4, stack = 12;
 	const long long sim_step = 50, sim_count = 1000;
+	const unsigned long long seed = 1;
+	const double tolerance = 0; // relativna greska srednjeg pV; 0 = fiksno sim_count koraka
+	const long long reorder_interval = 0; // preuredjivanje cestica po Mortonovoj krivoj svakih n dogadjaja; 0 = iskljuceno
+	const bool log_events = false; // binarni dnevnik sudara za kasniju reprodukciju (Replay)
+	const bool autotune = true; // red, niti i preuredjivanje po kratkom merenju, pamti se po klasi konfiguracije
+	const double correlation_interval = 0; // korak uzorkovanja MSD i VACF u sekundama simulacije; 0 = iskljuceno
+	const double structure_interval = 0; // korak uzorkovanja g(r) i S(k) u sekundama simulacije; 0 = iskljuceno
+	const double sample_interval = 0; // korak snimanja raspodele brzina u sekundama simulacije; 0 = iskljuceno
+	const int field_resolution = 0; // polja gustine, brzine i temperature na mrezi n x n, po prozoru u _fields.bin; 0 = iskljuceno
+	const bool live_monitor = false; // stanje simulacije u deljenoj memoriji igs_<kljuc>_<pid>, cita se sa: monitor <ime>
+	const bool pv_estimators = false; // pV i iz virijala sudara i iz g(r) na dodiru, uz kombinaciju najmanje varijanse
+	const bool free_flight = false; // cestice prolaze jedna kroz drugu, udari u zidove se broje u zatvorenom obliku, O(N) po prozoru
+	// klip: desni zid se krece brzinom piston_speed (m/s, < 0 sabija) po piston_move prozora, pa miruje
+	// piston_hold prozora; cela izoterma iz jedne simulacije. 0 = bez klipa
+	const double piston_speed = 0, piston_min_width = 0.5;
+	const int piston_move = 20, piston_hold = 20;
+	const string container = ""; // .obj kontura umesto kutije hfw x hfw
 	ParticleConfig pc1(0, r_1, m_1),
 		pc2(1, r_2, m_2);
 	int rows[] = /*{1, 2, 3, 4, 5}; */ {1, 2, 3, 4, 5, 7, 10, 12, 15, 17, 20, 23, 25, 30, 35, 40};
 	string prefix, name;
+	ResultCache cache("cache");
+	SnapshotLibrary snapshots("snapshots"); // uravnotezena stanja za topli start
+	AutoTuner tuner("autotune.txt");
+	Arena arena; // memorija jedne simulacije, ponovo se koristi za sledecu
 	for (double hfw = 1e7; hfw < 1e8/*1e-4; hfw <= 1e7*/; hfw *= 10) {
 		for (int l = 15; l < 16; l++) {
 			/*string name = "pv_";
@@ -77,23 +206,82 @@ int main(int argc, char** argv) {
 			name += "d_" + std::to_string(N) + ".txt";*/
 			prefix = toStringScientific(hfw) + "_" + toStringScientific(r_1) + "_" + toStringScientific(m_1);// +"/";
 			name = std::to_string(rows[l] * rows[l]) + ".txt";
-			std::cout << "Pocetak simulacije " << prefix << " N = " << rows[l] * rows[l] << std::endl;
-			Simulation2D sim2d(kB, T, hfw, &pc1, &pc2, 1.1, sim_step, sim_count, 0, rows[l] * rows[l], rows[l], rows[l]);
-			ICustomOnSimulationListener* listener = new ICustomOnSimulationListener(prefix, name);
-			sim2d.setOnSimulationListener(listener);
-			sim2d.run();
+			string key, config;
+			{
+				Simulation2D sim2d(kB, T, hfw, &pc1, &pc2, 1.1, sim_step, sim_count, 0, rows[l] * rows[l], rows[l], rows[l]);
+				sim2d.setSeed(seed);
+				sim2d.setAdaptive(tolerance);
+				if (!container.empty()) sim2d.setContainer(container);
+				sim2d.setSnapshotLibrary(&snapshots);
+				sim2d.setArena(&arena);
+				sim2d.setReorderInterval(reorder_interval);
+				// sve sto menja rezultat ili izlazne fajlove ulazi u kljuc, pa se postavlja pre njega
+				if (log_events) sim2d.setEventLog(prefix + "/" + name + "_events.bin");
+				sim2d.setSampling(sample_interval);
+				sim2d.setFields(field_resolution);
+				sim2d.setCorrelation(correlation_interval);
+				sim2d.setStructureSampling(structure_interval, 10 * r_2, 100, 8);
+				sim2d.setPiston(piston_speed, piston_move, piston_hold, piston_min_width * hfw);
+				sim2d.setFreeFlight(free_flight);
+				sim2d.setPressureEstimators(pv_estimators);
+				key = sim2d.getConfigKey();
+				config = sim2d.getConfigString();
+				if (cache.restore(key, prefix, name)) {
+					std::cout << "Preuzeto iz kesa " << prefix << " N = " << rows[l] * rows[l] << " (" << key << ")" << std::endl;
+					continue;
+				}
+				// podesavanja ne menjaju rezultat ni kljuc, pa se kalibracija radi tek kad kes promasi
+				if (autotune) {
+					int N = rows[l] * rows[l];
+					EngineSettings settings = tuner.get(sim2d.getTuningClass(), [&]() {
+						Simulation* sim = new Simulation2D(kB, T, hfw, &pc1, &pc2, 1.1, sim_step, sim_count, 0, N, rows[l], rows[l]);
+						sim->setSeed(seed);
+						if (!container.empty()) sim->setContainer(container);
+						return sim;
+					}, sim_step * sim_count);
+					AutoTuner::apply(&sim2d, settings);
+				}
+				std::cout << "Pocetak simulacije " << prefix << " N = " << rows[l] * rows[l] << std::endl;
+				ICustomOnSimulationListener listener(prefix, name);
+				sim2d.setOnSimulationListener(&listener);
+				if (live_monitor) {
+					// pid razlikuje procese koji rade istu konfiguraciju
+					string monitor_name = "igs_" + key + "_" + std::to_string(Monitor::processId());
+					sim2d.setMonitor(monitor_name);
+					std::cout << "Pracenje: " << argv[0] << " monitor " << monitor_name << std::endl;
+				}
+				sim2d.run();
+				if (sim2d.isWarmStarted()) std::cout << "Topli start iz biblioteke stanja" << std::endl;
+				std::cout << "pV = " << sim2d.getMeanPV() << " +- " << sim2d.getStdErrPV() << " (ekvilibracija " << sim2d.getEquilibrationStep() << "/" << sim2d.getStepCount() << " koraka)" << std::endl;
+				if (pv_estimators) {
+					std::cout << "pV (virijal) = " << sim2d.getMeanPV(PV_VIRIAL) << " +- " << sim2d.getStdErrPV(PV_VIRIAL)
+						<< ", pV (dodir) = " << sim2d.getMeanPV(PV_CONTACT) << " +- " << sim2d.getStdErrPV(PV_CONTACT)
+						<< ", 2K/d = " << sim2d.getMeanPV(PV_KINETIC) << std::endl;
+					std::cout << "pV (kombinovano) = " << sim2d.getMeanPV(PV_COMBINED) << " +- " << sim2d.getStdErrPV(PV_COMBINED) << std::endl;
+				}
+				SimulationStats stats = sim2d.getStats();
+				std::cout << "Pokretanje " << stats.startup << " s (predvidjanje " << stats.prediction << " s, red " << stats.queue_build << " s, " << stats.threads << " niti), ukupno " << stats.run << " s" << std::endl;
+				if (stats.reorders > 0) std::cout << "Preuredjivanja: " << stats.reorders << " (" << stats.reorder << " s)" << std::endl;
+				if (piston_speed != 0) {
+					vector<double> volume, pv;
+					ofstream isotherm(prefix + "/" + name + "_isotherm.txt");
+					int count = sim2d.getIsotherm(volume, pv);
+					for (int k = 0; k < count; k++) isotherm << volume[k] << "\t" << pv[k] << endl;
+				}
+			}
+			cache.store(key, config, prefix, name);
 
 			std::cout << std::endl;
 		}
 	}
 	std::cout << "Zavrseno!" << std::endl;
 	/*Simulation2D sim2d(kB, T, hfw, &pc1, &pc2, 1, sim_step, sim_count, row, col);
-	ICustomOnSimulationListener* listener = new ICustomOnSimulationListener();
-	sim2d.setOnSimulationListener(listener);
+	ICustomOnSimulationListener listener;
+	sim2d.setOnSimulationListener(&listener);
 	sim2d.run();*/
 	/*Simulation3D sim3d(kB, T, hfw, &pc1, &pc2, 0.5, sim_step, sim_count, row, col, stack);
-	ICustomOnSimulationListener* listener = new ICustomOnSimulationListener();
-	sim3d.setOnSimulationListener(listener);
+	ICustomOnSimulationListener listener;
+	sim3d.setOnSimulationListener(&listener);
 	sim3d.run();*/
 	
 	return 0;
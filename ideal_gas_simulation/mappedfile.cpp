@@ -0,0 +1,77 @@
+#include "mappedfile.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string path) {
+    data = nullptr;
+    size = 0;
+    file = nullptr;
+    mapping = nullptr;
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(f, &length) || length.QuadPart == 0) {
+        CloseHandle(f);
+        return;
+    }
+    HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m == NULL) {
+        CloseHandle(f);
+        return;
+    }
+    void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        CloseHandle(m);
+        CloseHandle(f);
+        return;
+    }
+    file = f;
+    mapping = m;
+    data = (const char*)view;
+    size = (size_t)length.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if (view == MAP_FAILED) return;
+    data = (const char*)view;
+    size = (size_t)st.st_size;
+#endif
+}
+
+bool MappedFile::isOpen() {
+    return data != nullptr;
+}
+
+const char* MappedFile::getData() {
+    return data;
+}
+
+size_t MappedFile::getSize() {
+    return size;
+}
+
+MappedFile::~MappedFile() {
+    if (data == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mapping);
+    CloseHandle((HANDLE)file);
+#else
+    munmap((void*)data, size);
+#endif
+}
@@ -0,0 +1,21 @@
+#include <string>
+#include <stddef.h>
+#ifndef H_MAPPEDFILE
+#define H_MAPPEDFILE
+
+// read-only view of a whole file
+class MappedFile {
+protected:
+	const char* data;
+	size_t size;
+	void* file, * mapping;
+
+public:
+	MappedFile(std::string path);
+	bool isOpen();
+	const char* getData();
+	size_t getSize();
+	~MappedFile();
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "monitor.h"
+#include <string.h>
+#include <sstream>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+#define MONITOR_READ_ATTEMPTS 1000
+
+int64_t Monitor::processId() {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+bool Monitor::isAlive(int64_t pid) {
+    if (pid <= 0) return false;
+#ifdef _WIN32
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+    if (process == NULL) return false;
+    DWORD code = 0;
+    bool alive = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// the owner creates and initialises the block, readers only map it. a block left behind by a
+// dead owner is taken over, one whose owner still runs is not
+Monitor::Monitor(std::string name, bool owner) {
+    this->name = name;
+    this->owner = owner;
+    block = nullptr;
+    mapping = nullptr;
+#ifdef _WIN32
+    std::string path = "Local\\" + name;
+    HANDLE m = owner ? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(MonitorBlock), path.c_str())
+        : OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+    if (m == NULL) return;
+    // a mapping outlives its owner only while readers hold it
+    bool existed = owner && GetLastError() == ERROR_ALREADY_EXISTS;
+    void* view = MapViewOfFile(m, owner ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sizeof(MonitorBlock));
+    if (view == NULL || (existed && memcmp(((MonitorBlock*)view)->magic, MONITOR_MAGIC, sizeof(MONITOR_MAGIC) - 1) == 0
+        && isAlive(((MonitorBlock*)view)->pid))) {
+        if (view != NULL) UnmapViewOfFile(view);
+        CloseHandle(m);
+        return;
+    }
+    mapping = m;
+#else
+    std::string path = "/" + name;
+    int fd = owner ? shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644) : shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0 && owner && errno == EEXIST) {
+        Monitor existing(name, false);
+        if (existing.isOpen() && memcmp(existing.block->magic, MONITOR_MAGIC, sizeof(existing.block->magic)) == 0
+            && isAlive(existing.block->pid)) return;
+        shm_unlink(path.c_str());
+        fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) return;
+    struct stat st;
+    if (owner ? ftruncate(fd, sizeof(MonitorBlock)) != 0 : fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MonitorBlock)) {
+        close(fd);
+        return;
+    }
+    void* view = mmap(nullptr, sizeof(MonitorBlock), owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return;
+#endif
+    block = (MonitorBlock*)view;
+    if (owner) {
+        block->sequence.store(1, std::memory_order_relaxed);
+        memset(&block->state, 0, sizeof(MonitorState));
+        block->pid = processId();
+        memcpy(block->magic, MONITOR_MAGIC, sizeof(block->magic));
+        block->sequence.store(2, std::memory_order_release);
+    }
+}
+
+Monitor* Monitor::create(std::string name) {
+    return new Monitor(name, true);
+}
+
+Monitor* Monitor::open(std::string name) {
+    Monitor* monitor = new Monitor(name, false);
+    if (monitor->isOpen() && memcmp(monitor->block->magic, MONITOR_MAGIC, sizeof(monitor->block->magic)) != 0) {
+        delete monitor;
+        return new Monitor("", false);
+    }
+    return monitor;
+}
+
+bool Monitor::isOpen() {
+    return block != nullptr;
+}
+
+// wait free: two stores of the sequence around a copy
+void Monitor::publish(const MonitorState& update) {
+    if (block == nullptr || !owner) return;
+    uint64_t s = block->sequence.load(std::memory_order_relaxed);
+    block->sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&block->state, &update, sizeof(MonitorState));
+    block->sequence.store(s + 2, std::memory_order_release);
+}
+
+// false when no consistent copy could be taken, e.g. the writer died mid-update
+bool Monitor::read(MonitorState& copy) {
+    if (block == nullptr) return false;
+    for (int attempt = 0; attempt < MONITOR_READ_ATTEMPTS; attempt++) {
+        uint64_t before = block->sequence.load(std::memory_order_acquire);
+        if (before % 2 == 0) {
+            memcpy(&copy, &block->state, sizeof(MonitorState));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (block->sequence.load(std::memory_order_relaxed) == before) return true;
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+std::string Monitor::toString(const MonitorState& s) {
+    std::ostringstream ss;
+    ss << (s.finished ? "finished" : "running") << " t=" << s.sim_time << " s, " << s.events << " events ("
+        << s.events_per_second << "/s, " << s.wall_time << " s wall), queue " << s.queue_size << ", " << s.threads << " threads";
+    ss << std::endl << "windows " << s.windows << ", latest pV/NkBT";
+    long long shown = s.windows < 8 ? s.windows : 8;
+    for (long long l = s.windows - shown; l < s.windows; l++) ss << " " << (s.NkBT > 0 ? s.pv[l % MONITOR_HISTORY] / s.NkBT : 0);
+    ss << std::endl << "startup " << s.startup << " s (prediction " << s.prediction << " s, queue " << s.queue_build << " s), "
+        << s.reorders << " reorders (" << s.reorder << " s)";
+    ss << std::endl << s.config;
+    return ss.str();
+}
+
+// the owner removes the name; readers that still map the block keep their view
+Monitor::~Monitor() {
+    if (block == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(block);
+    CloseHandle((HANDLE)mapping);
+#else
+    munmap(block, sizeof(MonitorBlock));
+    if (owner) shm_unlink(("/" + name).c_str());
+#endif
+}
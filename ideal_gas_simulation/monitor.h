@@ -0,0 +1,52 @@
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#ifndef H_MONITOR
+#define H_MONITOR
+
+#define MONITOR_MAGIC "IGSMON02"
+#define MONITOR_HISTORY 64
+
+// what a simulation publishes; plain data. pv is a ring of the latest windows,
+// pv[(windows - 1) % MONITOR_HISTORY] being the newest
+struct MonitorState {
+	double sim_time, wall_time, events_per_second;
+	long long events, queue_size, windows, reorders;
+	double pv[MONITOR_HISTORY];
+	double NkBT, startup, prediction, queue_build, reorder;
+	int threads, finished;
+	char config[512];
+};
+
+struct MonitorBlock {
+	char magic[8];
+	std::atomic<uint64_t> sequence;
+	int64_t pid;
+	MonitorState state;
+};
+
+// named shared memory that a running simulation publishes into, readable by any process on the
+// node. a seqlock: the writer makes the sequence odd, writes and makes it even again, and never
+// waits; a reader copies the block and retries when the sequence was odd or moved meanwhile.
+// create refuses a name whose block a live process still owns
+class Monitor {
+protected:
+	MonitorBlock* block;
+	void* mapping;
+	std::string name;
+	bool owner;
+	Monitor(std::string name, bool owner);
+	static bool isAlive(int64_t pid);
+
+public:
+	static int64_t processId();
+	static Monitor* create(std::string name);
+	static Monitor* open(std::string name);
+	bool isOpen();
+	void publish(const MonitorState& update);
+	bool read(MonitorState& copy);
+	static std::string toString(const MonitorState& s);
+	~Monitor();
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "reference.h"
+#include <math.h>
+
+double ReferenceKernel::approachTime(double vv, double dv, double dd, double cross2, double rr) {
+    if (dv >= 0 || vv == 0) return NOT_COLLIDING;
+    if (dd <= rr) return 0;
+    double disc = vv * rr - cross2;
+    if (disc < 0) return NOT_COLLIDING;
+    return (-dv - sqrt(disc)) / vv;
+}
+
+double ReferenceKernel::hitTime(Line2D* w, Particle2D* p) {
+    Point2D* c = p->getCenter(), * p1 = w->getFirstPoint(), * p2 = w->getSecondPoint();
+    Vector2D* v = p->getVelocity();
+    Vector2D e(p1, p2, true),
+        d(p1, c),
+        n(-e.getY(), e.getX());
+    int side = w->getSide();
+    double r = p->getRadius(), best = NOT_COLLIDING,
+        s = d.scalar(&n), vn = v->scalar(&n);
+
+    if (side != 0) {
+        s *= side;
+        vn *= side;
+    }
+    if ((side != 0 && vn < 0) || (side == 0 && s * vn < 0)) {
+        double t = (fabs(s) - r) / fabs(vn);
+        if (t < 0 || (side != 0 && s < 0)) t = 0;
+        double a = d.scalar(&e) + v->scalar(&e) * t;
+        if (a >= 0 && a <= Point2D::distance(p1, p2)) best = t;
+    }
+
+    Point2D* ends[2] = { p1, p2 };
+    for (int l = 0; l < 2; l++) {
+        Vector2D de(ends[l], c);
+        double cross = de.getX() * v->getY() - de.getY() * v->getX(),
+            t = approachTime(v->scalar(v), de.scalar(v), de.scalar(&de), cross * cross, r * r);
+        if (t >= 0 && (best < 0 || t < best)) best = t;
+    }
+    return best;
+}
+
+Point2D ReferenceKernel::closestPoint(Line2D* w, Point2D* c) {
+    Point2D* p1 = w->getFirstPoint();
+    Vector2D e(p1, w->getSecondPoint()), d(p1, c);
+    double a = d.scalar(&e) / e.scalar(&e);
+    a = a < 0 ? 0 : a > 1 ? 1 : a;
+    return Point2D(p1->getX() + a * e.getX(), p1->getY() + a * e.getY());
+}
+
+double ReferenceKernel::reflect(Line2D* w, Particle2D* p) {
+    Point2D* c = p->getCenter(), * p1 = w->getFirstPoint();
+    Vector2D* v = p->getVelocity();
+    Vector2D e(p1, w->getSecondPoint()), d(p1, c), n(-e.getY(), e.getX());
+    int side = w->getSide();
+    double a = d.scalar(&e) / e.scalar(&e);
+
+    if (side != 0) n.multiply(side);
+    else if (n.scalar(&d) < 0 || (n.scalar(&d) == 0 && n.scalar(v) > 0)) n.multiply(-1);
+    if (a <= 0 || a >= 1) {
+        Point2D q = closestPoint(w, c);
+        Vector2D nq(&q, c);
+        if (nq.len() > 0 && (side == 0 || nq.scalar(&n) > 0)) n = nq;
+    }
+    n.multiply(1 / n.len());
+
+    double vn = v->scalar(&n);
+    if (vn >= 0) return 0;
+    v->set(v->getX() - 2 * vn * n.getX(), v->getY() - 2 * vn * n.getY());
+    return -2 * p->getMass() * vn;
+}
+
+double ReferenceKernel::hitTime(Triangle* w, Particle3D* p) {
+    Point3D* c = p->getCenter(), * p1 = w->getFirstPoint(), * p2 = w->getSecondPoint(), * p3 = w->getThirdPoint();
+    Vector3D* v = p->getVelocity();
+    Vector3D e1(p1, p2),
+        e2(p1, p3),
+        n = Vector3D::vector(&e1, &e2, true),
+        d(p1, c);
+    int side = w->getSide();
+    double r = p->getRadius(), best = NOT_COLLIDING,
+        s = d.scalar(&n), vn = v->scalar(&n);
+
+    if ((side != 0 && side * vn < 0) || (side == 0 && s * vn < 0)) {
+        double t = (fabs(s) - r) / fabs(vn);
+        if (t < 0 || side * s < 0) t = 0;
+        Vector3D q(d.getX() + v->getX() * t - n.getX() * (s + vn * t),
+            d.getY() + v->getY() * t - n.getY() * (s + vn * t),
+            d.getZ() + v->getZ() * t - n.getZ() * (s + vn * t));
+        double d00 = e1.scalar(&e1), d01 = e1.scalar(&e2), d11 = e2.scalar(&e2),
+            d20 = q.scalar(&e1), d21 = q.scalar(&e2), den = d00 * d11 - d01 * d01,
+            bv = (d11 * d20 - d01 * d21) / den, bw = (d00 * d21 - d01 * d20) / den;
+        if (bv >= 0 && bw >= 0 && bv + bw <= 1) best = t;
+    }
+
+    Point3D* corners[3] = { p1, p2, p3 };
+    for (int l = 0; l < 3; l++) {
+        Vector3D u(corners[l], corners[(l + 1) % 3], true), de(corners[l], c);
+        double len = Point3D::distance(corners[l], corners[(l + 1) % 3]), da = de.scalar(&u), va = v->scalar(&u);
+        Vector3D dp(de.getX() - da * u.getX(), de.getY() - da * u.getY(), de.getZ() - da * u.getZ()),
+            vp(v->getX() - va * u.getX(), v->getY() - va * u.getY(), v->getZ() - va * u.getZ()),
+            cross = Vector3D::vector(&dp, &vp, false);
+        double t = approachTime(vp.scalar(&vp), dp.scalar(&vp), dp.scalar(&dp), cross.scalar(&cross), r * r);
+        if (t >= 0 && (best < 0 || t < best) && da + va * t >= 0 && da + va * t <= len) best = t;
+
+        Vector3D vertex_cross = Vector3D::vector(&de, v, false);
+        t = approachTime(v->scalar(v), de.scalar(v), de.scalar(&de), vertex_cross.scalar(&vertex_cross), r * r);
+        if (t >= 0 && (best < 0 || t < best)) best = t;
+    }
+    return best;
+}
+
+Point3D ReferenceKernel::closestPoint(Triangle* w, Point3D* c) {
+    Point3D* p1 = w->getFirstPoint(), * p2 = w->getSecondPoint(), * p3 = w->getThirdPoint();
+    Vector3D e1(p1, p2),
+        e2(p1, p3),
+        n = Vector3D::vector(&e1, &e2, true),
+        d(p1, c);
+    double s = d.scalar(&n);
+    Vector3D q(d.getX() - s * n.getX(), d.getY() - s * n.getY(), d.getZ() - s * n.getZ());
+    double d00 = e1.scalar(&e1), d01 = e1.scalar(&e2), d11 = e2.scalar(&e2),
+        d20 = q.scalar(&e1), d21 = q.scalar(&e2), den = d00 * d11 - d01 * d01,
+        bv = (d11 * d20 - d01 * d21) / den, bw = (d00 * d21 - d01 * d20) / den;
+    if (bv >= 0 && bw >= 0 && bv + bw <= 1)
+        return Point3D(c->getX() - s * n.getX(), c->getY() - s * n.getY(), c->getZ() - s * n.getZ());
+
+    Point3D* corners[3] = { p1, p2, p3 };
+    Point3D best(p1);
+    double best_d = -1;
+    for (int l = 0; l < 3; l++) {
+        Vector3D u(corners[l], corners[(l + 1) % 3]), de(corners[l], c);
+        double a = de.scalar(&u) / u.scalar(&u);
+        a = a < 0 ? 0 : a > 1 ? 1 : a;
+        Point3D q(corners[l]->getX() + a * u.getX(), corners[l]->getY() + a * u.getY(), corners[l]->getZ() + a * u.getZ());
+        double dist = Point3D::distance(&q, c);
+        if (best_d < 0 || dist < best_d) {
+            best_d = dist;
+            best.set(q.getX(), q.getY(), q.getZ());
+        }
+    }
+    return best;
+}
+
+double ReferenceKernel::reflect(Triangle* w, Particle3D* p) {
+    Point3D* c = p->getCenter(), * p1 = w->getFirstPoint();
+    Vector3D* v = p->getVelocity();
+    Vector3D e1(p1, w->getSecondPoint()),
+        e2(p1, w->getThirdPoint()),
+        face = Vector3D::vector(&e1, &e2, true),
+        d(p1, c),
+        n(&face);
+    Point3D q = closestPoint(w, c);
+    int side = w->getSide();
+    double s = d.scalar(&face);
+
+    Point3D proj(c->getX() - s * face.getX(), c->getY() - s * face.getY(), c->getZ() - s * face.getZ());
+    if (side != 0) n.multiply(side);
+    else if (s < 0 || (s == 0 && n.scalar(v) > 0)) n.multiply(-1);
+    if (Point3D::distance(&q, &proj) > 0) {
+        Vector3D nq(&q, c);
+        if (nq.len() > 0 && (side == 0 || nq.scalar(&n) > 0)) n = nq;
+    }
+    n.multiply(1 / n.len());
+
+    double vn = v->scalar(&n);
+    if (vn >= 0) return 0;
+    v->set(v->getX() - 2 * vn * n.getX(), v->getY() - 2 * vn * n.getY(), v->getZ() - 2 * vn * n.getZ());
+    return -2 * p->getMass() * vn;
+}
+
+double ReferenceKernel::collision(PhObject* o1, PhObject* o2, double act) {
+    double t = act;
+    if (!PhObject::isParticle(o1) && !PhObject::isParticle(o2)) return NOT_COLLIDING;
+    else if ((o1->getType() == LINE_2D && o2->getType() == PARTICLE_2D) ||
+        (o1->getType() == PARTICLE_2D && o2->getType() == LINE_2D)) {
+        Line2D* sw = static_cast<Line2D*>(o1->getType() == LINE_2D ? o1 : o2);
+        Particle2D* p = static_cast<Particle2D*>(o1->getType() == LINE_2D ? o2 : o1);
+        if (act < -0.5) return hitTime(sw, p);
+        else t = reflect(sw, p);
+    }
+    else if ((o1->getType() == CONTAINER_2D && o2->getType() == PARTICLE_2D) ||
+        (o1->getType() == PARTICLE_2D && o2->getType() == CONTAINER_2D)) {
+        Container2D* box = static_cast<Container2D*>(o1->getType() == CONTAINER_2D ? o1 : o2);
+        Particle2D* p = static_cast<Particle2D*>(o1->getType() == CONTAINER_2D ? o2 : o1);
+        if (act < -0.5) return box->hitTime(p);
+        else t = box->reflect(p);
+    }
+    else if (o1->getType() == PARTICLE_2D && o2->getType() == PARTICLE_2D) {
+        Particle2D* p1 = static_cast<Particle2D*>(o1), * p2 = static_cast<Particle2D*>(o2);
+        Vector2D* v1 = p1->getVelocity(), * v2 = p2->getVelocity();
+        Point2D* c1 = p1->getCenter(), * c2 = p2->getCenter();
+        if (act < -0.5) {
+            double dx = c1->getX() - c2->getX(), dy = c1->getY() - c2->getY(),
+                vx = v1->getX() - v2->getX(), vy = v1->getY() - v2->getY(),
+                rr = p1->getRadius() + p2->getRadius(), cross = dx * vy - dy * vx;
+            return approachTime(vx * vx + vy * vy, dx * vx + dy * vy, dx * dx + dy * dy, cross * cross, rr * rr);
+        }
+        else {
+            Vector2D tang(c1, c2, true),
+                ort(-tang.getY(), tang.getX()),
+                tang1 = Vector2D::projection(v1, &tang),
+                tang2 = Vector2D::projection(v2, &tang),
+                ort1 = Vector2D::projection(v1, &ort),
+                ort2 = Vector2D::projection(v2, &ort);
+            double m1 = p1->getMass(), m2 = p2->getMass(),
+                a11 = (m1 - m2) / (m1 + m2), a12 = 2 * m2 / (m1 + m2),
+                a21 = 2 * m1 / (m1 + m2), a22 = (m2 - m1) / (m1 + m2);
+            v1->set(a11 * tang1.getX() + a12 * tang2.getX() + ort1.getX(), a11 * tang1.getY() + a12 * tang2.getY() + ort1.getY());
+            v2->set(a21 * tang1.getX() + a22 * tang2.getX() + ort2.getX(), a21 * tang1.getY() + a22 * tang2.getY() + ort2.getY());
+            t = 0;
+        }
+    }
+    else if ((o1->getType() == TRIANGLE && o2->getType() == PARTICLE_3D) ||
+        (o1->getType() == PARTICLE_3D && o2->getType() == TRIANGLE)) {
+        Triangle* triangle = static_cast<Triangle*>(o1->getType() == TRIANGLE ? o1 : o2);
+        Particle3D* p = static_cast<Particle3D*>(o1->getType() == TRIANGLE ? o2 : o1);
+        if (act < -0.5) return hitTime(triangle, p);
+        else t = reflect(triangle, p);
+    }
+    else if ((o1->getType() == CONTAINER_3D && o2->getType() == PARTICLE_3D) ||
+        (o1->getType() == PARTICLE_3D && o2->getType() == CONTAINER_3D)) {
+        Container3D* box = static_cast<Container3D*>(o1->getType() == CONTAINER_3D ? o1 : o2);
+        Particle3D* p = static_cast<Particle3D*>(o1->getType() == CONTAINER_3D ? o2 : o1);
+        if (act < -0.5) return box->hitTime(p);
+        else t = box->reflect(p);
+    }
+    else if (o1->getType() == PARTICLE_3D && o2->getType() == PARTICLE_3D) {
+        Particle3D* p1 = static_cast<Particle3D*>(o1), * p2 = static_cast<Particle3D*>(o2);
+        Vector3D* v1 = p1->getVelocity(), * v2 = p2->getVelocity();
+        Point3D* c1 = p1->getCenter(), * c2 = p2->getCenter();
+        if (act < -0.5) {
+            double dx = c1->getX() - c2->getX(), dy = c1->getY() - c2->getY(), dz = c1->getZ() - c2->getZ(),
+                vx = v1->getX() - v2->getX(), vy = v1->getY() - v2->getY(), vz = v1->getZ() - v2->getZ(),
+                rr = p1->getRadius() + p2->getRadius(),
+                cx = dy * vz - dz * vy, cy = dz * vx - dx * vz, cz = dx * vy - dy * vx;
+            return approachTime(vx * vx + vy * vy + vz * vz, dx * vx + dy * vy + dz * vz, dx * dx + dy * dy + dz * dz, cx * cx + cy * cy + cz * cz, rr * rr);
+        }
+        else {
+            Vector3D tang(c1, c2, true),
+                tang1 = Vector3D::projection(v1, &tang),
+                tang2 = Vector3D::projection(v2, &tang),
+                ort1 = Vector3D::sub(v1, &tang1),
+                ort2 = Vector3D::sub(v2, &tang2);
+            double m1 = p1->getMass(), m2 = p2->getMass(),
+                a11 = (m1 - m2) / (m1 + m2), a12 = 2 * m2 / (m1 + m2),
+                a21 = 2 * m1 / (m1 + m2), a22 = (m2 - m1) / (m1 + m2);
+            v1->set(a11 * tang1.getX() + a12 * tang2.getX() + ort1.getX(), a11 * tang1.getY() + a12 * tang2.getY() + ort1.getY(), a11 * tang1.getZ() + a12 * tang2.getZ() + ort1.getZ());
+            v2->set(a21 * tang1.getX() + a22 * tang2.getX() + ort2.getX(), a21 * tang1.getY() + a22 * tang2.getY() + ort2.getY(), a21 * tang1.getZ() + a22 * tang2.getZ() + ort2.getZ());
+            t = 0;
+        }
+    }
+    else return UNKNOWN;
+
+    return t;
+}
@@ -0,0 +1,22 @@
+#include "geometry.h"
+#ifndef H_REFERENCE
+#define H_REFERENCE
+
+// frozen copy of the collision kernel of engine version 3, kept as the oracle for optimised
+// kernels; do not change it together with PhObject::collision. containers keep using their
+// own BVH queries, only segments, facets and particle pairs are frozen
+class ReferenceKernel {
+protected:
+	static double approachTime(double vv, double dv, double dd, double cross2, double rr);
+	static double hitTime(Line2D* w, Particle2D* p);
+	static Point2D closestPoint(Line2D* w, Point2D* c);
+	static double reflect(Line2D* w, Particle2D* p);
+	static double hitTime(Triangle* w, Particle3D* p);
+	static Point3D closestPoint(Triangle* w, Point3D* c);
+	static double reflect(Triangle* w, Particle3D* p);
+
+public:
+	static double collision(PhObject* o1, PhObject* o2, double act);
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include "rng.h"
+#include <vector>
+#include <math.h>
+
+// velocities for ids first .. first + count - 1, dim components each, v[i * dim + k] with the
+// standard deviation sigma[i]. the integer pass and the box-muller pass have no loop carried
+// state, so both vectorise; every id reads its own blocks n = 0, 1, so the result for an id
+// does not depend on the size or the start of the batch
+void CounterRNG::maxwell(uint32_t stream, uint64_t first, int count, int dim, const double* sigma, double* v) const {
+    const double two_pi = 6.283185307179586476925286766559;
+    int pairs = (dim + 1) / 2;
+    std::vector<double> u((size_t)count * pairs * 2);
+    for (int i = 0; i < count; i++)
+        for (int n = 0; n < pairs; n++)
+            uniform2(stream, first + i, n, u[((size_t)i * pairs + n) * 2], u[((size_t)i * pairs + n) * 2 + 1]);
+    for (size_t l = 0; l < u.size(); l += 2) {
+        double r = sqrt(-2 * log(u[l])), phi = two_pi * u[l + 1];
+        u[l] = r * cos(phi);
+        u[l + 1] = r * sin(phi);
+    }
+    for (int i = 0; i < count; i++)
+        for (int k = 0; k < dim; k++) v[(size_t)i * dim + k] = sigma[i] * u[(size_t)i * pairs * 2 + k];
+}
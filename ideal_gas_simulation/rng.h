@@ -0,0 +1,66 @@
+#include <cstdint>
+#ifndef H_RNG
+#define H_RNG
+
+// independent streams of the counter based generator; a draw is a pure function of
+// (seed, stream, id, n), so it does not matter in which order or on which thread it happens
+enum RNG_STREAM { STREAM_SPECIES, STREAM_VELOCITY, STREAM_JITTER, STREAM_POSITION, STREAM_COLLISION };
+
+// philox 4x32-10 (salmon et al., "parallel random numbers: as easy as 1, 2, 3"); the state
+// is the 128-bit counter {id, n, stream} and the 64-bit seed is the key
+class CounterRNG {
+protected:
+	uint64_t seed;
+
+	static inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+		uint64_t p = (uint64_t)a * b;
+		hi = (uint32_t)(p >> 32);
+		lo = (uint32_t)p;
+	}
+
+public:
+	CounterRNG(uint64_t seed = 0) : seed(seed) {}
+	void setSeed(uint64_t seed) { this->seed = seed; }
+	uint64_t getSeed() const { return seed; }
+
+	static inline void philox(uint32_t c[4], uint64_t key) {
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int r = 0; r < 10; r++) {
+			uint32_t hi0, lo0, hi1, lo1;
+			mulhilo(0xD2511F53u, c[0], hi0, lo0);
+			mulhilo(0xCD9E8D57u, c[2], hi1, lo1);
+			c[0] = hi1 ^ c[1] ^ k0;
+			c[1] = lo1;
+			c[2] = hi0 ^ c[3] ^ k1;
+			c[3] = lo0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+	}
+
+	inline void block(uint32_t stream, uint64_t id, uint32_t n, uint32_t out[4]) const {
+		out[0] = (uint32_t)id;
+		out[1] = (uint32_t)(id >> 32);
+		out[2] = n;
+		out[3] = stream;
+		philox(out, seed);
+	}
+
+	// two doubles in (0, 1] with 53 random bits each
+	inline void uniform2(uint32_t stream, uint64_t id, uint32_t n, double& a, double& b) const {
+		uint32_t c[4];
+		block(stream, id, n, c);
+		a = ((((uint64_t)c[0] << 32 | c[1]) >> 11) + 1) * 0x1.0p-53;
+		b = ((((uint64_t)c[2] << 32 | c[3]) >> 11) + 1) * 0x1.0p-53;
+	}
+
+	inline double uniform(uint32_t stream, uint64_t id, uint32_t n = 0) const {
+		double a, b;
+		uniform2(stream, id, n, a, b);
+		return a;
+	}
+
+	void maxwell(uint32_t stream, uint64_t first, int count, int dim, const double* sigma, double* v) const;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "snapshot.h"
+#include "mappedfile.h"
+#include <filesystem>
+#include <fstream>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+namespace fs = std::filesystem;
+
+SnapshotLibrary::SnapshotLibrary(std::string dir) {
+    this->dir = dir;
+}
+
+std::string SnapshotLibrary::fileName(int dim, int n, double packing, double mix) {
+    char name[96];
+    snprintf(name, sizeof(name), "%dd_%d_%.6e_%.4f.snap", dim, n, packing, mix);
+    return dir + "/" + name;
+}
+
+void SnapshotLibrary::save(int dim, int n, double packing, double mix, const std::vector<double>& positions) {
+    if ((int)positions.size() != dim * n) return;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.dim = dim;
+    header.n = n;
+    header.packing = packing;
+    header.mix = mix;
+
+    // written aside and renamed, so concurrent runs never map a partial file
+    std::string path = fileName(dim, n, packing, mix);
+    std::ofstream out(path + ".tmp", std::ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)positions.data(), positions.size() * sizeof(double));
+    out.close();
+    if (!out) return;
+    fs::rename(path + ".tmp", path, ec);
+}
+
+// the nearest entry within SNAPSHOT_MAX_DISTANCE; empty when there is none
+std::string SnapshotLibrary::find(int dim, int n, double packing, double mix) {
+    std::error_code ec;
+    std::string best;
+    double best_d = SNAPSHOT_MAX_DISTANCE;
+    for (auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.path().extension() != ".snap") continue;
+        MappedFile file(entry.path().string());
+        if (!file.isOpen() || file.getSize() < sizeof(SnapshotHeader)) continue;
+        SnapshotHeader header;
+        memcpy(&header, file.getData(), sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.dim != dim || header.n != n) continue;
+        if (file.getSize() != sizeof(SnapshotHeader) + (size_t)dim * n * sizeof(double) || header.packing <= 0) continue;
+        // packing fractions compare on a log scale, the sweep varies them by decades
+        double d = fabs(log(header.packing / packing)) + fabs(header.mix - mix);
+        if (d <= best_d) {
+            best_d = d;
+            best = entry.path().string();
+        }
+    }
+    return best;
+}
+
+bool SnapshotLibrary::load(int dim, int n, double packing, double mix, std::vector<double>& positions) {
+    std::string best = find(dim, n, packing, mix);
+    if (best.empty()) return false;
+
+    MappedFile file(best);
+    if (!file.isOpen() || file.getSize() != sizeof(SnapshotHeader) + (size_t)dim * n * sizeof(double)) return false;
+    positions.resize((size_t)dim * n);
+    memcpy(positions.data(), file.getData() + sizeof(SnapshotHeader), positions.size() * sizeof(double));
+    return true;
+}
@@ -0,0 +1,31 @@
+#include <string>
+#include <vector>
+#ifndef H_SNAPSHOT
+#define H_SNAPSHOT
+
+#define SNAPSHOT_MAGIC "IGSSNAP1"
+// farthest entry a load takes: |ln(packing ratio)| + |mix difference|, about half a decade
+#define SNAPSHOT_MAX_DISTANCE 1.15
+
+struct SnapshotHeader {
+	char magic[8];
+	int dim, n;
+	double packing, mix;
+};
+
+// equilibrated particle positions keyed by (dim, N, packing fraction, fraction of species 1);
+// positions are stored divided by the box half width, so they rescale to any box size, and
+// ordered by particle index
+class SnapshotLibrary {
+protected:
+	std::string dir;
+	std::string fileName(int dim, int n, double packing, double mix);
+
+public:
+	SnapshotLibrary(std::string dir);
+	void save(int dim, int n, double packing, double mix, const std::vector<double>& positions);
+	std::string find(int dim, int n, double packing, double mix);
+	bool load(int dim, int n, double packing, double mix, std::vector<double>& positions);
+};
+
+#endif
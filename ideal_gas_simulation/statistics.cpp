@@ -0,0 +1,123 @@
+#include "statistics.h"
+#include <math.h>
+#include <algorithm>
+
+#define MIN_BLOCKS 16
+
+double Statistics::mean(const double* x, int n) {
+    double s = 0;
+    for (int l = 0; l < n; l++) s += x[l];
+    return n > 0 ? s / n : 0;
+}
+
+double Statistics::variance(const double* x, int n) {
+    if (n < 2) return 0;
+    double m = mean(x, n), s = 0;
+    for (int l = 0; l < n; l++) s += (x[l] - m) * (x[l] - m);
+    return s / (n - 1);
+}
+
+// MSER-m: truncation point (in samples) minimising the squared standard error of the
+// remaining batch means, searched over the first half of the series
+int Statistics::mser(const double* x, int n, int batch) {
+    int k = n / batch;
+    if (k < 4) return 0;
+    std::vector<double> z(k);
+    for (int l = 0; l < k; l++) z[l] = mean(x + l * batch, batch);
+
+    double s = 0, s2 = 0;
+    for (int l = 0; l < k; l++) {
+        s += z[l];
+        s2 += z[l] * z[l];
+    }
+    int best = 0;
+    double best_val = -1;
+    for (int d = 0; d <= k / 2; d++) {
+        int m = k - d;
+        double mu = s / m, val = (s2 / m - mu * mu) / m;
+        if (best_val < 0 || val < best_val) {
+            best_val = val;
+            best = d;
+        }
+        s -= z[d];
+        s2 -= z[d] * z[d];
+    }
+    return best * batch;
+}
+
+// Flyvbjerg-Petersen blocking; the largest estimate over levels that still have
+// MIN_BLOCKS blocks is a conservative standard error for correlated samples
+double Statistics::blockStdErr(const double* x, int n) {
+    if (n < 2) return 0;
+    std::vector<double> b(x, x + n);
+    double err = sqrt(variance(b.data(), n) / n);
+    while (n / 2 >= MIN_BLOCKS) {
+        n /= 2;
+        for (int l = 0; l < n; l++) b[l] = (b[2 * l] + b[2 * l + 1]) / 2;
+        double e = sqrt(variance(b.data(), n) / n);
+        if (e > err) err = e;
+    }
+    return err;
+}
+
+// covariance matrix (k x k, row major) of the means of k series sampled together, from the
+// block means at the coarsest level that still has MIN_BLOCKS blocks; returns the block count
+int Statistics::blockCovariance(const double* const* x, int k, int n, std::vector<double>& cov) {
+    cov.assign((size_t)k * k, 0);
+    int size = 1;
+    while (n / (size * 2) >= MIN_BLOCKS) size *= 2;
+    int m = n / size;
+    if (m < 2) return 0;
+    std::vector<double> b((size_t)k * m), mu(k);
+    for (int a = 0; a < k; a++) {
+        for (int l = 0; l < m; l++) b[(size_t)a * m + l] = mean(x[a] + (size_t)l * size, size);
+        mu[a] = mean(b.data() + (size_t)a * m, m);
+    }
+    for (int a = 0; a < k; a++)
+        for (int c = 0; c <= a; c++) {
+            double s = 0;
+            for (int l = 0; l < m; l++) s += (b[(size_t)a * m + l] - mu[a]) * (b[(size_t)c * m + l] - mu[c]);
+            cov[(size_t)a * k + c] = cov[(size_t)c * k + a] = s / (m - 1) / m;
+        }
+    return m;
+}
+
+// minimum variance (generalised least squares) combination of k estimators of the same mean:
+// weights = C^-1 1 / (1' C^-1 1) with C from blockCovariance. the weights sum to one, so the
+// combined series is unbiased whatever they are; false when C is singular, e.g. identical series
+bool Statistics::combine(const double* const* x, int k, int n, std::vector<double>& weights, std::vector<double>& combined) {
+    std::vector<double> a;
+    weights.assign(k, 1);
+    combined.clear();
+    if (k < 1 || blockCovariance(x, k, n, a) == 0) return false;
+    // gaussian elimination with partial pivoting; tiny pivots relative to the diagonal mean a
+    // combination that is exact up to rounding and cannot be trusted
+    double scale = 0;
+    for (int l = 0; l < k; l++) scale += a[(size_t)l * k + l];
+    if (scale <= 0) return false;
+    for (int c = 0; c < k; c++) {
+        int p = c;
+        for (int r = c + 1; r < k; r++)
+            if (fabs(a[(size_t)r * k + c]) > fabs(a[(size_t)p * k + c])) p = r;
+        if (fabs(a[(size_t)p * k + c]) < 1e-12 * scale) return false;
+        for (int j = 0; j < k; j++) std::swap(a[(size_t)c * k + j], a[(size_t)p * k + j]);
+        std::swap(weights[c], weights[p]);
+        for (int r = c + 1; r < k; r++) {
+            double f = a[(size_t)r * k + c] / a[(size_t)c * k + c];
+            for (int j = c; j < k; j++) a[(size_t)r * k + j] -= f * a[(size_t)c * k + j];
+            weights[r] -= f * weights[c];
+        }
+    }
+    double total = 0;
+    for (int c = k - 1; c >= 0; c--) {
+        for (int j = c + 1; j < k; j++) weights[c] -= a[(size_t)c * k + j] * weights[j];
+        weights[c] /= a[(size_t)c * k + c];
+        total += weights[c];
+    }
+    if (total == 0) return false;
+    for (int c = 0; c < k; c++) weights[c] /= total;
+    combined.assign(n, 0);
+    for (int c = 0; c < k; c++)
+        for (int l = 0; l < n; l++) combined[l] += weights[c] * x[c][l];
+    return true;
+}
@@ -0,0 +1,15 @@
+#include <vector>
+#ifndef H_STATISTICS
+#define H_STATISTICS
+
+class Statistics {
+public:
+	static double mean(const double* x, int n);
+	static double variance(const double* x, int n);
+	static int mser(const double* x, int n, int batch);
+	static double blockStdErr(const double* x, int n);
+	static int blockCovariance(const double* const* x, int k, int n, std::vector<double>& cov);
+	static bool combine(const double* const* x, int k, int n, std::vector<double>& weights, std::vector<double>& combined);
+};
+
+#endif
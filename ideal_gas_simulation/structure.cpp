@@ -0,0 +1,219 @@
+#include "structure.h"
+#include <fstream>
+#include <iomanip>
+#include <math.h>
+
+#define PI 3.14159265358979323846
+#define STRUCTURE_CELLS_PER_PARTICLE 4
+
+// species[i] is the group of particle i; volume, lo and hi describe the container
+StructureSampler::StructureSampler(int dim, std::vector<int>& species, int groups, double volume, double* lo, double* hi, double cutoff, int bins, int k_points, int threads) {
+    this->dim = dim;
+    this->n = (int)species.size();
+    this->groups = groups;
+    this->species = species;
+    this->volume = volume;
+    this->cutoff = cutoff;
+    this->bins = bins;
+    this->k_points = k_points;
+    group_size.assign(groups, 0);
+    for (int g : species) group_size[g]++;
+
+    // cells at least as wide as the cutoff, so only neighbouring cells hold partners; a dilute
+    // box would need far more cells than particles, so their number is capped
+    int max_cells = (int)pow((double)STRUCTURE_CELLS_PER_PARTICLE * (n > 0 ? n : 1), 1.0 / dim);
+    if (max_cells < 1) max_cells = 1;
+    for (int k = 0; k < 3; k++) {
+        this->lo[k] = k < dim ? lo[k] : 0;
+        this->hi[k] = k < dim ? hi[k] : 0;
+        double width = this->hi[k] - this->lo[k];
+        cells[k] = k < dim && cutoff > 0 ? (int)(width / cutoff) : 1;
+        if (cells[k] > max_cells) cells[k] = max_cells;
+        if (cells[k] < 1) cells[k] = 1;
+        cell_size[k] = width > 0 ? width / cells[k] : 1;
+    }
+
+    pool = new ThreadPool(threads);
+    tasks = pool->getThreadCount();
+    task_bins.assign(tasks, std::vector<long long>((size_t)groups * groups * bins, 0));
+    task_waves.assign(tasks, std::vector<double>((size_t)dim * k_points * 2, 0));
+    sk_sum.assign(k_points, 0);
+    samples = 0;
+    pending = false;
+}
+
+int StructureSampler::pairIndex(int a, int b) {
+    return a < b ? a * groups + b : b * groups + a;
+}
+
+// counting sort of the particles by cell
+void StructureSampler::buildGrid() {
+    int total = cells[0] * cells[1] * cells[2];
+    std::vector<int> cell_of(n);
+    cell_start.assign(total + 1, 0);
+    cell_items.resize(n);
+    for (int l = 0; l < n; l++) {
+        int index = 0;
+        for (int k = dim - 1; k >= 0; k--) {
+            int c = (int)((positions[(size_t)l * dim + k] - lo[k]) / cell_size[k]);
+            c = c < 0 ? 0 : (c >= cells[k] ? cells[k] - 1 : c);
+            index = index * cells[k] + c;
+        }
+        cell_of[l] = index;
+        cell_start[index + 1]++;
+    }
+    for (int c = 0; c < total; c++) cell_start[c + 1] += cell_start[c];
+    std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int l = 0; l < n; l++) cell_items[fill[cell_of[l]]++] = l;
+}
+
+// cells are dealt out round-robin; a pair is counted from its lower particle index only
+void StructureSampler::countPairs(int task) {
+    std::vector<long long>& histogram = task_bins[task];
+    int total = cells[0] * cells[1] * cells[2];
+    double cutoff2 = cutoff * cutoff;
+    for (int c = task; c < total; c += tasks) {
+        int cx = c % cells[0], cy = (c / cells[0]) % cells[1], cz = c / (cells[0] * cells[1]);
+        for (int dz = dim == 3 ? -1 : 0; dz <= (dim == 3 ? 1 : 0); dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++) {
+                    int x = cx + dx, y = cy + dy, z = cz + dz;
+                    if (x < 0 || y < 0 || z < 0 || x >= cells[0] || y >= cells[1] || z >= cells[2]) continue;
+                    int other = (z * cells[1] + y) * cells[0] + x;
+                    for (int a = cell_start[c]; a < cell_start[c + 1]; a++) {
+                        int i = cell_items[a];
+                        const double* pi = &positions[(size_t)i * dim];
+                        for (int b = cell_start[other]; b < cell_start[other + 1]; b++) {
+                            int j = cell_items[b];
+                            if (j <= i) continue;
+                            const double* pj = &positions[(size_t)j * dim];
+                            double rr = 0;
+                            for (int k = 0; k < dim; k++) rr += (pi[k] - pj[k]) * (pi[k] - pj[k]);
+                            if (rr >= cutoff2) continue;
+                            int bin = (int)(sqrt(rr) / cutoff * bins);
+                            if (bin >= bins) bin = bins - 1;
+                            histogram[(size_t)pairIndex(species[i], species[j]) * bins + bin]++;
+                        }
+                    }
+                }
+    }
+}
+
+// partial sums of exp(i k x) over a slice of the particles, k = 2 pi m / L along every axis
+void StructureSampler::sumWaves(int task) {
+    std::vector<double>& waves = task_waves[task];
+    std::fill(waves.begin(), waves.end(), 0);
+    int from = (int)((long long)n * task / tasks), to = (int)((long long)n * (task + 1) / tasks);
+    for (int k = 0; k < dim; k++) {
+        double length = hi[k] - lo[k];
+        for (int l = from; l < to; l++) {
+            double phase = 2 * PI * (positions[(size_t)l * dim + k] - lo[k]) / length;
+            for (int m = 1; m <= k_points; m++) {
+                waves[((size_t)k * k_points + m - 1) * 2] += cos(m * phase);
+                waves[((size_t)k * k_points + m - 1) * 2 + 1] += sin(m * phase);
+            }
+        }
+    }
+}
+
+// waits for the sample in flight and folds its wave sums into S(k)
+void StructureSampler::collect() {
+    if (!pending) return;
+    pool->wait();
+    for (int m = 0; m < k_points; m++) {
+        double s = 0;
+        for (int k = 0; k < dim; k++) {
+            double re = 0, im = 0;
+            for (int t = 0; t < tasks; t++) {
+                re += task_waves[t][((size_t)k * k_points + m) * 2];
+                im += task_waves[t][((size_t)k * k_points + m) * 2 + 1];
+            }
+            s += (re * re + im * im) / n;
+        }
+        sk_sum[m] += s / dim;
+    }
+    samples++;
+    pending = false;
+}
+
+void StructureSampler::add(const double* positions) {
+    collect();
+    if (n == 0) return;
+    this->positions.assign(positions, positions + (size_t)n * dim);
+    buildGrid();
+    for (int t = 0; t < tasks; t++)
+        pool->submit([this, t]() {
+            if (cutoff > 0 && bins > 0) countPairs(t);
+            if (k_points > 0) sumWaves(t);
+        });
+    pending = true;
+}
+
+void StructureSampler::finish() {
+    collect();
+}
+
+long long StructureSampler::getSampleCount() {
+    return samples;
+}
+
+// normalised by the ideal gas count of the same pairs in the shell; the walls cut off part
+// of the shells near them, so g(r) of a small box falls below 1 towards the cutoff
+int StructureSampler::getRDF(int a, int b, std::vector<double>& r, std::vector<double>& g) {
+    finish();
+    r.clear();
+    g.clear();
+    if (samples == 0 || bins == 0) return 0;
+    double pairs = a == b ? group_size[a] * (group_size[a] - 1) / 2 : group_size[a] * group_size[b];
+    for (int bin = 0; bin < bins; bin++) {
+        long long count = 0;
+        for (int t = 0; t < tasks; t++) count += task_bins[t][(size_t)pairIndex(a, b) * bins + bin];
+        double r1 = cutoff * bin / bins, r2 = cutoff * (bin + 1) / bins,
+            shell = dim == 3 ? 4 * PI * (r2 * r2 * r2 - r1 * r1 * r1) / 3 : PI * (r2 * r2 - r1 * r1),
+            expected = pairs * shell / volume * samples;
+        r.push_back((r1 + r2) / 2);
+        g.push_back(expected > 0 ? count / expected : 0);
+    }
+    return bins;
+}
+
+// k along the first axis; the other axes use the same m
+int StructureSampler::getStructureFactor(std::vector<double>& k, std::vector<double>& s) {
+    finish();
+    k.clear();
+    s.clear();
+    if (samples == 0) return 0;
+    for (int m = 1; m <= k_points; m++) {
+        k.push_back(2 * PI * m / (hi[0] - lo[0]));
+        s.push_back(sk_sum[m - 1] / samples);
+    }
+    return k_points;
+}
+
+// rdf: r, then g of every pair a <= b; sk: k, S(k)
+bool StructureSampler::write(std::string rdf_path, std::string sk_path) {
+    std::ofstream rdf(rdf_path), sk(sk_path);
+    if (!rdf.is_open() || !sk.is_open()) return false;
+    rdf << std::setprecision(17);
+    sk << std::setprecision(17);
+    std::vector<std::vector<double>> g;
+    std::vector<double> r, values;
+    for (int a = 0; a < groups; a++)
+        for (int b = a; b < groups; b++) {
+            getRDF(a, b, r, values);
+            g.push_back(values);
+        }
+    for (size_t l = 0; l < r.size(); l++) {
+        rdf << r[l];
+        for (std::vector<double>& column : g) rdf << "\t" << column[l];
+        rdf << std::endl;
+    }
+    getStructureFactor(r, values);
+    for (size_t l = 0; l < r.size(); l++) sk << r[l] << "\t" << values[l] << std::endl;
+    return true;
+}
+
+StructureSampler::~StructureSampler() {
+    finish();
+    delete pool;
+}
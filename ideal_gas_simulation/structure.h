@@ -0,0 +1,43 @@
+#include <string>
+#include <vector>
+#include "threadpool.h"
+#ifndef H_STRUCTURE
+#define H_STRUCTURE
+
+// g(r) per species pair up to a cutoff and S(k) at the lowest wave numbers of the box.
+// add() copies the positions, sorts them into a grid of cells no smaller than the cutoff and
+// hands the pair counting to the pool, so the caller only pays O(N); the work of one sample
+// overlaps the events up to the next one. every task counts into its own bins
+class StructureSampler {
+protected:
+	int dim, n, groups, bins, k_points, tasks;
+	double cutoff, volume, lo[3], hi[3], cell_size[3];
+	int cells[3];
+	std::vector<int> species;
+	std::vector<double> group_size;
+	std::vector<double> positions;
+	std::vector<int> cell_start, cell_items;
+	std::vector<std::vector<long long>> task_bins;
+	std::vector<std::vector<double>> task_waves;
+	std::vector<double> sk_sum;
+	long long samples;
+	bool pending;
+	ThreadPool* pool;
+	int pairIndex(int a, int b);
+	void buildGrid();
+	void countPairs(int task);
+	void sumWaves(int task);
+	void collect();
+
+public:
+	StructureSampler(int dim, std::vector<int>& species, int groups, double volume, double* lo, double* hi, double cutoff, int bins, int k_points, int threads);
+	void add(const double* positions);
+	void finish();
+	long long getSampleCount();
+	int getRDF(int a, int b, std::vector<double>& r, std::vector<double>& g);
+	int getStructureFactor(std::vector<double>& k, std::vector<double>& s);
+	bool write(std::string rdf_path, std::string sk_path);
+	~StructureSampler();
+};
+
+#endif
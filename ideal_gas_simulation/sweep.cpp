@@ -0,0 +1,283 @@
+#include "sweep.h"
+#include "autotune.h"
+#include "arena.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <math.h>
+
+// seconds between touches of a claim held by a running worker
+#define CLAIM_HEARTBEAT 60
+
+namespace fs = std::filesystem;
+
+SweepListener::SweepListener(std::string dir) {
+    this->dir = dir;
+    this->NkBT = 0;
+}
+
+void SweepListener::OnSimulationStart(PhObject** objs, int objs_len) {
+}
+
+void SweepListener::OnSimulationIteration(PhObject** objs, int objs_len, int sim_ite) {
+}
+
+void SweepListener::OnSimulationStep(double pV, double NkBT, int sim_step) {
+    pv.push_back(pV);
+    this->NkBT = NkBT;
+}
+
+void SweepListener::OnSimulationEnd(PhObject** objs, int objs_len) {
+    std::ofstream out(dir + "/pv.txt");
+    out << std::setprecision(17);
+    for (double p : pv) out << p << std::endl;
+}
+
+Simulation* Sweep::build(RunConfig& c) {
+    ParticleConfig pc1(0, c.r_1, c.m_1), pc2(1, c.r_2, c.m_2);
+    Simulation* sim;
+    if (c.dim == 3) sim = new Simulation3D(c.kB, c.T, c.hfw, &pc1, &pc2, c.rate, c.sim_step, c.sim_count, c.N_offset, c.N_real, c.row, c.col, c.stack);
+    else sim = new Simulation2D(c.kB, c.T, c.hfw, &pc1, &pc2, c.rate, c.sim_step, c.sim_count, c.N_offset, c.N_real, c.row, c.col);
+    sim->setSeed(c.seed);
+    sim->setAdaptive(c.tolerance);
+    if (!c.container.empty() && c.container != "-") sim->setContainer(c.container);
+    return sim;
+}
+
+// description: one "key = value value ..." per line; the manifest holds the cartesian
+// product in file order, the last key varying fastest
+int Sweep::plan(std::string description, std::string manifest) {
+    std::ifstream in(description);
+    if (!in.is_open()) {
+        std::cerr << "Cannot read sweep description " << description << std::endl;
+        return -1;
+    }
+    std::vector<std::string> keys;
+    std::vector<std::vector<std::string>> values;
+    std::string line, key, eq, value;
+    while (std::getline(in, line)) {
+        if (line.find('#') != std::string::npos) line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        if (!(ss >> key >> eq) || eq != "=") continue;
+        keys.push_back(key);
+        values.push_back(std::vector<std::string>());
+        while (ss >> value) values.back().push_back(value);
+        if (values.back().empty()) {
+            std::cerr << "No values for " << key << std::endl;
+            return -1;
+        }
+    }
+
+    std::string tmp = manifest + ".tmp";
+    std::ofstream out(tmp);
+    out << std::setprecision(17);
+    out << "# id dim kB T hfw r_1 r_2 m_1 m_2 rate tolerance sim_step sim_count N_offset N_real row col stack seed container" << std::endl;
+    std::vector<int> idx(keys.size(), 0);
+    int count = 0;
+    while (true) {
+        RunConfig c;
+        c.dim = 2;
+        c.kB = 1.3806503e-23;
+        c.T = 273 + 30;
+        c.hfw = 1e5;
+        c.r_1 = 1e-6;
+        c.r_2 = 5e-6;
+        c.m_1 = 1;
+        c.m_2 = 2;
+        c.rate = 1.1;
+        c.tolerance = 0;
+        c.sim_step = 50;
+        c.sim_count = 1000;
+        c.row = c.col = c.stack = 4;
+        c.N_offset = 0;
+        c.N_real = -1;
+        c.seed = 1;
+        c.container = "-";
+        for (int k = 0; k < (int)keys.size(); k++) {
+            std::string v = values[k][idx[k]];
+            if (keys[k] == "dim") c.dim = std::stoi(v);
+            else if (keys[k] == "kB") c.kB = std::stod(v);
+            else if (keys[k] == "T") c.T = std::stod(v);
+            else if (keys[k] == "hfw") c.hfw = std::stod(v);
+            else if (keys[k] == "r_1") c.r_1 = std::stod(v);
+            else if (keys[k] == "r_2") c.r_2 = std::stod(v);
+            else if (keys[k] == "m_1") c.m_1 = std::stod(v);
+            else if (keys[k] == "m_2") c.m_2 = std::stod(v);
+            else if (keys[k] == "rate") c.rate = std::stod(v);
+            else if (keys[k] == "tolerance") c.tolerance = std::stod(v);
+            else if (keys[k] == "sim_step") c.sim_step = std::stoll(v);
+            else if (keys[k] == "sim_count") c.sim_count = std::stoll(v);
+            else if (keys[k] == "rows") c.row = c.col = c.stack = std::stoi(v);
+            else if (keys[k] == "row") c.row = std::stoi(v);
+            else if (keys[k] == "col") c.col = std::stoi(v);
+            else if (keys[k] == "stack") c.stack = std::stoi(v);
+            else if (keys[k] == "N_offset") c.N_offset = std::stoi(v);
+            else if (keys[k] == "N_real") c.N_real = std::stoi(v);
+            else if (keys[k] == "seed") c.seed = std::stoull(v);
+            else if (keys[k] == "container") c.container = v;
+            else {
+                std::cerr << "Unknown sweep key " << keys[k] << std::endl;
+                return -1;
+            }
+        }
+        if (c.N_real < 0) c.N_real = c.row * c.col * (c.dim == 3 ? c.stack : 1);
+
+        Simulation* sim = build(c);
+        c.id = sim->getConfigKey();
+        delete sim;
+        out << c.id << " " << c.dim << " " << c.kB << " " << c.T << " " << c.hfw << " " << c.r_1 << " " << c.r_2 << " "
+            << c.m_1 << " " << c.m_2 << " " << c.rate << " " << c.tolerance << " " << c.sim_step << " " << c.sim_count << " "
+            << c.N_offset << " " << c.N_real << " " << c.row << " " << c.col << " " << c.stack << " " << c.seed << " " << c.container << std::endl;
+        count++;
+
+        int k = (int)keys.size() - 1;
+        while (k >= 0 && ++idx[k] == (int)values[k].size()) idx[k--] = 0;
+        if (k < 0) break;
+    }
+    out.close();
+    std::error_code ec;
+    fs::rename(tmp, manifest, ec);
+    return ec ? -1 : count;
+}
+
+std::vector<RunConfig> Sweep::readManifest(std::string manifest) {
+    std::vector<RunConfig> runs;
+    std::ifstream in(manifest);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream ss(line);
+        RunConfig c;
+        if (ss >> c.id >> c.dim >> c.kB >> c.T >> c.hfw >> c.r_1 >> c.r_2 >> c.m_1 >> c.m_2 >> c.rate >> c.tolerance
+            >> c.sim_step >> c.sim_count >> c.N_offset >> c.N_real >> c.row >> c.col >> c.stack >> c.seed >> c.container)
+            runs.push_back(c);
+    }
+    return runs;
+}
+
+// the claim is a directory, whose creation is atomic on local and network filesystems; its
+// modification time is the heartbeat of the worker holding it
+bool Sweep::claim(std::string runs, std::string id, double stale_hours) {
+    std::error_code ec;
+    fs::path path = fs::path(runs) / (id + ".claim");
+    if (fs::create_directory(path, ec)) return true;
+    if (stale_hours <= 0) return false;
+
+    auto age = fs::file_time_type::clock::now() - fs::last_write_time(path, ec);
+    if (ec || std::chrono::duration<double, std::ratio<3600>>(age).count() < stale_hours) return false;
+    // only one of the workers racing for a stale claim manages to move it away
+    std::random_device rd;
+    fs::rename(path, fs::path(runs) / (id + ".stale." + std::to_string(rd())), ec);
+    if (ec) return false;
+    return fs::create_directory(path, ec);
+}
+
+int Sweep::work(std::string manifest, std::string outdir, int shard, int shards, double stale_hours) {
+    if (shards < 1 || shard < 0 || shard >= shards) {
+        std::cerr << "Cannot work on shard " << shard << " of " << shards << ", shards are numbered 0 to count - 1" << std::endl;
+        return -1;
+    }
+    std::vector<RunConfig> configs = readManifest(manifest);
+    std::string runs = outdir + "/runs";
+    std::error_code ec;
+    fs::create_directories(runs, ec);
+    AutoTuner tuner(outdir + "/autotune.txt");
+    // one arena for the whole shard; it grows to the largest run and is reused by the rest
+    Arena arena;
+    int done = 0;
+    for (int l = 0; l < (int)configs.size(); l++) {
+        RunConfig& c = configs[l];
+        if (l % shards != shard) continue;
+        if (fs::exists(runs + "/" + c.id + ".done", ec)) continue;
+        if (!claim(runs, c.id, stale_hours)) continue;
+
+        // touched until the run is done, so only a claim whose worker died goes stale
+        fs::path claimed = fs::path(runs) / (c.id + ".claim");
+        std::mutex heartbeat_lock;
+        std::condition_variable heartbeat_stop;
+        bool finished = false;
+        std::thread heartbeat([&]() {
+            std::unique_lock<std::mutex> lock(heartbeat_lock);
+            std::error_code touch_ec;
+            while (!heartbeat_stop.wait_for(lock, std::chrono::seconds(CLAIM_HEARTBEAT), [&]() { return finished; }))
+                fs::last_write_time(claimed, fs::file_time_type::clock::now(), touch_ec);
+        });
+
+        std::string dir = runs + "/" + c.id;
+        fs::create_directories(dir, ec);
+        std::cout << "Pocetak simulacije " << c.id << " (" << l + 1 << "/" << configs.size() << ")" << std::endl;
+        Simulation* sim = build(c);
+        EngineSettings settings = tuner.get(sim->getTuningClass(), [&c]() { return build(c); }, c.sim_step * c.sim_count);
+        AutoTuner::apply(sim, settings);
+        SweepListener listener(dir);
+        sim->setArena(&arena);
+        sim->setOnSimulationListener(&listener);
+        sim->run();
+        {
+            std::ofstream summary(dir + "/summary.txt");
+            summary << std::setprecision(17);
+            summary << "N=" << sim->getParticleCount() << std::endl;
+            summary << "NkBT=" << sim->getParticleCount() * c.kB * c.T << std::endl;
+            summary << "pV_mean=" << sim->getMeanPV() << std::endl;
+            summary << "pV_err=" << sim->getStdErrPV() << std::endl;
+            summary << "equilibration=" << sim->getEquilibrationStep() << std::endl;
+            summary << "steps=" << sim->getStepCount() << std::endl;
+        }
+        delete sim;
+
+        std::ofstream marker(runs + "/" + c.id + ".done.tmp");
+        marker << c.id << std::endl;
+        marker.close();
+        fs::rename(runs + "/" + c.id + ".done.tmp", runs + "/" + c.id + ".done", ec);
+        {
+            std::lock_guard<std::mutex> lock(heartbeat_lock);
+            finished = true;
+        }
+        heartbeat_stop.notify_one();
+        heartbeat.join();
+        done++;
+    }
+    return done;
+}
+
+int Sweep::merge(std::string manifest, std::string outdir, std::string dataset) {
+    std::vector<RunConfig> configs = readManifest(manifest);
+    std::string runs = outdir + "/runs";
+    std::ofstream out(dataset), series(dataset + ".pv");
+    out << std::setprecision(17);
+    series << std::setprecision(17);
+    out << "id\tdim\thfw\tr_1\tr_2\tm_1\tm_2\trate\tseed\tN\tNkBT\tpV_mean\tpV_err\tequilibration\tsteps" << std::endl;
+    series << "id\tstep\tpV" << std::endl;
+    int missing = 0;
+    std::error_code ec;
+    for (RunConfig& c : configs) {
+        if (!fs::exists(runs + "/" + c.id + ".done", ec)) {
+            missing++;
+            continue;
+        }
+        std::ifstream summary(runs + "/" + c.id + "/summary.txt"), pv(runs + "/" + c.id + "/pv.txt");
+        std::string line, N, NkBT, mean, err, eq, steps;
+        while (std::getline(summary, line)) {
+            std::string key = line.substr(0, line.find('=')), value = line.substr(line.find('=') + 1);
+            if (key == "N") N = value;
+            else if (key == "NkBT") NkBT = value;
+            else if (key == "pV_mean") mean = value;
+            else if (key == "pV_err") err = value;
+            else if (key == "equilibration") eq = value;
+            else if (key == "steps") steps = value;
+        }
+        out << c.id << "\t" << c.dim << "\t" << c.hfw << "\t" << c.r_1 << "\t" << c.r_2 << "\t" << c.m_1 << "\t" << c.m_2 << "\t"
+            << c.rate << "\t" << c.seed << "\t" << N << "\t" << NkBT << "\t" << mean << "\t" << err << "\t" << eq << "\t" << steps << std::endl;
+        int step = 0;
+        while (std::getline(pv, line)) series << c.id << "\t" << step++ << "\t" << line << std::endl;
+    }
+    if (missing > 0) std::cout << missing << " od " << configs.size() << " simulacija jos nije zavrseno" << std::endl;
+    return missing;
+}
@@ -0,0 +1,43 @@
+#include <string>
+#include <vector>
+#include "geometry.h"
+#ifndef H_SWEEP
+#define H_SWEEP
+
+struct RunConfig {
+	std::string id;
+	int dim;
+	double kB, T, hfw, r_1, r_2, m_1, m_2, rate, tolerance;
+	long long sim_step, sim_count;
+	int N_offset, N_real, row, col, stack;
+	unsigned long long seed;
+	std::string container;
+};
+
+class SweepListener : public IOnSimulationListener {
+protected:
+	std::string dir;
+	std::vector<double> pv;
+	double NkBT;
+
+public:
+	SweepListener(std::string dir);
+	void OnSimulationStart(PhObject** objs, int objs_len);
+	void OnSimulationIteration(PhObject** objs, int objs_len, int sim_ite);
+	void OnSimulationStep(double pV, double NkBT, int sim_step);
+	void OnSimulationEnd(PhObject** objs, int objs_len);
+};
+
+class Sweep {
+protected:
+	static bool claim(std::string runs, std::string id, double stale_hours);
+
+public:
+	static Simulation* build(RunConfig& c);
+	static int plan(std::string description, std::string manifest);
+	static std::vector<RunConfig> readManifest(std::string manifest);
+	static int work(std::string manifest, std::string outdir, int shard, int shards, double stale_hours);
+	static int merge(std::string manifest, std::string outdir, std::string dataset);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "threadpool.h"
+
+// threads <= 0: one per hardware thread
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+    busy = 0;
+    stopping = false;
+    for (int l = 0; l < threads; l++) workers.push_back(std::thread(&ThreadPool::loop, this));
+}
+
+void ThreadPool::loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            busy++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+            if (busy == 0 && tasks.empty()) idle.notify_all();
+        }
+    }
+}
+
+int ThreadPool::getThreadCount() {
+    return (int)workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return busy == 0 && tasks.empty(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
@@ -0,0 +1,30 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#ifndef H_THREADPOOL
+#define H_THREADPOOL
+
+// fixed set of workers that outlive the tasks, so per-sample work does not pay for thread
+// creation; wait() returns once every submitted task has finished
+class ThreadPool {
+protected:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake, idle;
+	int busy;
+	bool stopping;
+	void loop();
+
+public:
+	ThreadPool(int threads);
+	int getThreadCount();
+	void submit(std::function<void()> task);
+	void wait();
+	~ThreadPool();
+};
+
+#endif
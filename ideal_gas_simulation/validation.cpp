@@ -0,0 +1,223 @@
+#include "validation.h"
+#include "reference.h"
+#include "eventlog.h"
+#include <sstream>
+#include <iomanip>
+#include <math.h>
+#include <stdio.h>
+
+Validator::Validator(std::function<Simulation*()> make, std::function<void(Simulation*)> configure) {
+    this->make = make;
+    this->configure = configure;
+    trajectory_tolerance = 0;
+    energy_tolerance = 1e-9;
+    z_limit = 5;
+}
+
+// trajectory: relative difference allowed per coordinate, 0 = bitwise; energy: relative drift
+// over the long run; z: allowed distance of the statistics in standard errors
+void Validator::setTolerances(double trajectory, double energy, double z) {
+    trajectory_tolerance = trajectory;
+    energy_tolerance = energy;
+    z_limit = z;
+}
+
+void Validator::check(bool ok, std::string message) {
+    if (!ok) report.passed = false;
+    report.lines.push_back((ok ? "ok   " : "FAIL ") + message);
+}
+
+Simulation* Validator::reference() {
+    Simulation* sim = make();
+    sim->setCollisionKernel(ReferenceKernel::collision);
+    sim->setEventQueue(MULTISET_QUEUE);
+    sim->setThreadCount(1);
+    sim->setReorderInterval(0);
+    return sim;
+}
+
+Simulation* Validator::candidate() {
+    Simulation* sim = make();
+    configure(sim);
+    return sim;
+}
+
+static double deviation(double a, double b, double scale) {
+    if (a == b) return 0;
+    return scale > 0 ? fabs(a - b) / scale : fabs(a - b);
+}
+
+static double magnitude(std::vector<double>& values) {
+    double m = 0;
+    for (double value : values) m = fabs(value) > m ? fabs(value) : m;
+    return m;
+}
+
+// both engines are stepped one event at a time and compared after every event
+void Validator::compareTrajectories(long long events) {
+    Simulation* ref = reference(), * opt = candidate();
+    std::ostringstream ss;
+    ss << std::setprecision(17);
+    if (!ref->initialize() || !opt->initialize()) {
+        check(false, "trajectory: cannot initialize");
+        delete ref;
+        delete opt;
+        return;
+    }
+    std::vector<double> c1, v1, c2, v2;
+    long long k = 0;
+    bool same = true;
+    for (; k < events && same; k++) {
+        if (ref->step(1) != 1 || opt->step(1) != 1) break;
+        if (deviation(ref->getTime(), opt->getTime(), fabs(ref->getTime())) > trajectory_tolerance) {
+            ss << "trajectory: time differs after event " << k + 1 << ": " << ref->getTime() << " vs " << opt->getTime();
+            same = false;
+            break;
+        }
+        int dim = ref->snapshot(c1, v1);
+        opt->snapshot(c2, v2);
+        // relative to the extent of the system and the fastest particle, so that coordinates
+        // close to zero do not inflate the difference
+        size_t worst = 0;
+        double worst_dev = 0, c_scale = magnitude(c1), v_scale = magnitude(v1);
+        for (size_t l = 0; l < c1.size(); l++) {
+            double dc = deviation(c1[l], c2[l], c_scale), dv = deviation(v1[l], v2[l], v_scale),
+                d = dc > dv ? dc : dv;
+            if (d > worst_dev) {
+                worst_dev = d;
+                worst = l;
+            }
+        }
+        if (worst_dev > trajectory_tolerance) {
+            ss << "trajectory: particle " << worst / dim << " differs after event " << k + 1 << " by " << worst_dev
+                << " (position " << c1[worst] << " vs " << c2[worst] << ", velocity " << v1[worst] << " vs " << v2[worst] << ")";
+            same = false;
+        }
+    }
+    if (same) ss << "trajectory: " << k << " events identical" << (trajectory_tolerance > 0 ? " within tolerance" : "");
+    check(same, ss.str());
+    delete ref;
+    delete opt;
+}
+
+// full runs of both engines; the trajectories separate quickly, so only conserved
+// quantities and the statistics are compared
+void Validator::compareStatistics() {
+    Simulation* sims[2] = { reference(), candidate() };
+    const char* names[2] = { "reference", "candidate" };
+    double pv_mean[2] = { 0, 0 }, pv_err[2] = { 0, 0 }, elapsed[2] = { 0, 0 };
+    std::vector<double> impulse[2];
+    std::vector<long long> hits[2];
+    for (int s = 0; s < 2; s++) {
+        std::ostringstream ss;
+        if (!sims[s]->initialize()) {
+            check(false, std::string(names[s]) + ": cannot initialize");
+            continue;
+        }
+        double e0 = sims[s]->getKineticEnergy();
+        sims[s]->run();
+        double drift = e0 > 0 ? fabs(sims[s]->getKineticEnergy() - e0) / e0 : 0;
+        ss << names[s] << ": energy drift " << drift << " over " << sims[s]->getEventCount() << " events";
+        check(drift <= energy_tolerance, ss.str());
+        pv_mean[s] = sims[s]->getMeanPV();
+        pv_err[s] = sims[s]->getStdErrPV();
+        elapsed[s] = sims[s]->getTime();
+        sims[s]->getWallImpulse(impulse[s], hits[s]);
+    }
+
+    // a wall hit carries about one impulse quantum, so the relative error of a sum over
+    // n hits is close to sqrt(2 / n)
+    for (size_t w = 0; w < impulse[0].size() && w < impulse[1].size(); w++) {
+        if (hits[0][w] == 0 || hits[1][w] == 0) continue;
+        double r0 = impulse[0][w] / elapsed[0], r1 = impulse[1][w] / elapsed[1],
+            err = sqrt(r0 * r0 * 2 / hits[0][w] + r1 * r1 * 2 / hits[1][w]),
+            z = err > 0 ? fabs(r0 - r1) / err : 0;
+        std::ostringstream ss;
+        ss << "wall " << w << ": momentum rate " << r0 << " vs " << r1 << " (z = " << z << ", " << hits[0][w] << "/" << hits[1][w] << " hits)";
+        check(z <= z_limit, ss.str());
+    }
+
+    double err = sqrt(pv_err[0] * pv_err[0] + pv_err[1] * pv_err[1]),
+        z = err > 0 ? fabs(pv_mean[0] - pv_mean[1]) / err : (pv_mean[0] == pv_mean[1] ? 0 : INFINITY);
+    std::ostringstream ss;
+    ss << "pV: " << pv_mean[0] << " +- " << pv_err[0] << " vs " << pv_mean[1] << " +- " << pv_err[1] << " (z = " << z << ")";
+    check(z <= z_limit, ss.str());
+    delete sims[0];
+    delete sims[1];
+}
+
+// the candidate is logged through a mix of step and advanceTo, and the replay of the log has to
+// end in exactly the same state
+void Validator::compareReplay(long long events) {
+    std::string path = "validate_replay.bin";
+    Simulation* sim = candidate();
+    sim->setEventLog(path);
+    std::ostringstream ss;
+    if (!sim->initialize()) {
+        check(false, "replay: cannot initialize");
+        delete sim;
+        return;
+    }
+    for (int l = 0; l < 3; l++) {
+        sim->step(events / 3 + 1);
+        sim->advanceTo(sim->getTime() * 1.25);
+    }
+    std::vector<double> c1, v1, c2, v2;
+    int dim = sim->snapshot(c1, v1);
+    double t = sim->getTime();
+    long long n = sim->getEventCount();
+    // the log is flushed when the simulation goes
+    delete sim;
+
+    Replay replay(path);
+    if (!replay.isOpen()) {
+        check(false, "replay: cannot open the log");
+        remove(path.c_str());
+        return;
+    }
+    while (replay.step());
+    PhObject** objs = replay.getObjects();
+    c2.assign(c1.size(), 0);
+    v2.assign(v1.size(), 0);
+    for (int l = replay.getWallsLen(); l < replay.getObjectsLen(); l++) {
+        if (dim == 3) {
+            Particle3D* p = static_cast<Particle3D*>(objs[l]);
+            int i = p->getIndex();
+            c2[3 * i] = p->getCenter()->getX();
+            c2[3 * i + 1] = p->getCenter()->getY();
+            c2[3 * i + 2] = p->getCenter()->getZ();
+            v2[3 * i] = p->getVelocity()->getX();
+            v2[3 * i + 1] = p->getVelocity()->getY();
+            v2[3 * i + 2] = p->getVelocity()->getZ();
+        }
+        else {
+            Particle2D* p = static_cast<Particle2D*>(objs[l]);
+            int i = p->getIndex();
+            c2[2 * i] = p->getCenter()->getX();
+            c2[2 * i + 1] = p->getCenter()->getY();
+            v2[2 * i] = p->getVelocity()->getX();
+            v2[2 * i + 1] = p->getVelocity()->getY();
+        }
+    }
+    bool same = replay.getEvent() == n && replay.getTime() == t && c1 == c2 && v1 == v2;
+    ss << std::setprecision(17) << "replay: " << replay.getEvent() << "/" << n << " events to t = " << replay.getTime();
+    if (same) ss << ", state identical";
+    else ss << " vs " << t << ", state differs";
+    check(same, ss.str());
+    remove(path.c_str());
+}
+
+ValidationReport Validator::validate(long long short_events) {
+    report.passed = true;
+    report.lines.clear();
+    compareTrajectories(short_events);
+    compareStatistics();
+    compareReplay(short_events);
+    return report;
+}
+
+std::string Validator::toString(ValidationReport& report) {
+    std::string s;
+    for (std::string& line : report.lines) s += line + "\n";
+    return s + (report.passed ? "PASSED" : "FAILED");
+}
@@ -0,0 +1,36 @@
+#include <string>
+#include <vector>
+#include <functional>
+#include "geometry.h"
+#ifndef H_VALIDATION
+#define H_VALIDATION
+
+struct ValidationReport {
+	bool passed;
+	std::vector<std::string> lines;
+};
+
+// runs the frozen reference engine (ReferenceKernel, multiset queue, one thread, no reordering)
+// next to a candidate engine on the same seeded configuration; make has to return a fresh,
+// unstarted simulation on every call and configure turns it into the candidate
+class Validator {
+protected:
+	std::function<Simulation*()> make;
+	std::function<void(Simulation*)> configure;
+	double trajectory_tolerance, energy_tolerance, z_limit;
+	ValidationReport report;
+	void check(bool ok, std::string message);
+	Simulation* reference();
+	Simulation* candidate();
+	void compareTrajectories(long long events);
+	void compareStatistics();
+	void compareReplay(long long events);
+
+public:
+	Validator(std::function<Simulation*()> make, std::function<void(Simulation*)> configure);
+	void setTolerances(double trajectory, double energy, double z);
+	ValidationReport validate(long long short_events);
+	static std::string toString(ValidationReport& report);
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef H_VECMATH
+#define H_VECMATH
+
+// value types for the collision kernels; everything is inline and constexpr, so the kernels
+// compile to plain arithmetic on registers. there is no normalisation here: kernels work with
+// squared lengths and dot products and take the one sqrt they need themselves
+struct Vec2 {
+	double x, y;
+	constexpr Vec2() : x(0), y(0) {}
+	constexpr Vec2(double x, double y) : x(x), y(y) {}
+	constexpr Vec2 operator+(const Vec2& o) const { return Vec2(x + o.x, y + o.y); }
+	constexpr Vec2 operator-(const Vec2& o) const { return Vec2(x - o.x, y - o.y); }
+	constexpr Vec2 operator-() const { return Vec2(-x, -y); }
+	constexpr Vec2 operator*(double s) const { return Vec2(x * s, y * s); }
+	constexpr Vec2 operator/(double s) const { return Vec2(x / s, y / s); }
+	Vec2& operator+=(const Vec2& o) { x += o.x; y += o.y; return *this; }
+	Vec2& operator-=(const Vec2& o) { x -= o.x; y -= o.y; return *this; }
+	Vec2& operator*=(double s) { x *= s; y *= s; return *this; }
+};
+
+struct Vec3 {
+	double x, y, z;
+	constexpr Vec3() : x(0), y(0), z(0) {}
+	constexpr Vec3(double x, double y, double z) : x(x), y(y), z(z) {}
+	constexpr Vec3 operator+(const Vec3& o) const { return Vec3(x + o.x, y + o.y, z + o.z); }
+	constexpr Vec3 operator-(const Vec3& o) const { return Vec3(x - o.x, y - o.y, z - o.z); }
+	constexpr Vec3 operator-() const { return Vec3(-x, -y, -z); }
+	constexpr Vec3 operator*(double s) const { return Vec3(x * s, y * s, z * s); }
+	constexpr Vec3 operator/(double s) const { return Vec3(x / s, y / s, z / s); }
+	Vec3& operator+=(const Vec3& o) { x += o.x; y += o.y; z += o.z; return *this; }
+	Vec3& operator-=(const Vec3& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+	Vec3& operator*=(double s) { x *= s; y *= s; z *= s; return *this; }
+};
+
+constexpr Vec2 operator*(double s, const Vec2& v) { return v * s; }
+constexpr Vec3 operator*(double s, const Vec3& v) { return v * s; }
+
+constexpr double dot(const Vec2& a, const Vec2& b) { return a.x * b.x + a.y * b.y; }
+constexpr double dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+// z component of the 3D cross product
+constexpr double cross(const Vec2& a, const Vec2& b) { return a.x * b.y - a.y * b.x; }
+constexpr Vec3 cross(const Vec3& a, const Vec3& b) { return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+constexpr double norm2(const Vec2& v) { return dot(v, v); }
+constexpr double norm2(const Vec3& v) { return dot(v, v); }
+
+// left normal, as long as v
+constexpr Vec2 perp(const Vec2& v) { return Vec2(-v.y, v.x); }
+
+#endif